@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include "buf_pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define SZ_2M ((size_t)2 << 20)
+#define SZ_1G ((size_t)1 << 30)
+
+struct buf_pool {
+    pthread_mutex_t  lock;
+    pthread_cond_t   freed;
+    struct pool_buf *free_list;
+    struct pool_buf *bufs;
+    unsigned         nbufs;
+    size_t           buf_size;
+
+    void                 *slab;
+    size_t                slab_bytes;
+    enum buf_pool_backing backing;
+
+    unsigned in_use, peak_in_use;
+    uint64_t gets, stalls, stall_ns, tryget_fails;
+};
+
+static inline size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *map_hugetlb(size_t bytes, int huge_flag) {
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE | huge_flag,
+                   -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Regular anonymous mapping aligned to 2 MiB so THP can back all of it. */
+static void *map_thp(size_t bytes) {
+    size_t span = bytes + SZ_2M;
+    uint8_t *raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    uint8_t *p = (uint8_t *)round_up((uintptr_t)raw, SZ_2M);
+    size_t head = (size_t)(p - raw);
+    if (head)
+        munmap(raw, head);
+    munmap(p + bytes, span - head - bytes);
+
+    madvise(p, bytes, MADV_HUGEPAGE);
+    /* Prefault now rather than on first touch in the I/O loop. */
+    for (size_t off = 0; off < bytes; off += BUF_POOL_ALIGN)
+        p[off] = 0;
+    return p;
+}
+
+static int map_slab(struct buf_pool *pool, size_t bytes, unsigned flags) {
+    // A 1 GiB page only pays off when the slab fills most of it; rounding a
+    // few hundred MiB up to 1 GiB would pin the rest of a scarce page.
+    size_t len_1g = round_up(bytes, SZ_1G);
+    if ((flags & BUF_POOL_HUGE_1G) && bytes >= SZ_1G && len_1g - bytes <= len_1g / 8) {
+        size_t len = len_1g;
+        if ((pool->slab = map_hugetlb(len, MAP_HUGE_1GB))) {
+            pool->slab_bytes = len;
+            pool->backing = BUF_POOL_BACKING_HUGE_1G;
+            return 0;
+        }
+    }
+    if (flags & BUF_POOL_HUGE_2M) {
+        size_t len = round_up(bytes, SZ_2M);
+        if ((pool->slab = map_hugetlb(len, MAP_HUGE_2MB))) {
+            pool->slab_bytes = len;
+            pool->backing = BUF_POOL_BACKING_HUGE_2M;
+            return 0;
+        }
+    }
+    size_t len = round_up(bytes, SZ_2M);
+    if ((pool->slab = map_thp(len))) {
+        pool->slab_bytes = len;
+        pool->backing = BUF_POOL_BACKING_THP;
+        return 0;
+    }
+    return -1;
+}
+
+struct buf_pool *buf_pool_create(size_t buf_size, unsigned nbufs, unsigned flags) {
+    if (buf_size == 0 || nbufs == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct buf_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->bufs = calloc(nbufs, sizeof(*pool->bufs));
+    if (!pool->bufs) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->nbufs = nbufs;
+    pool->buf_size = round_up(buf_size, BUF_POOL_ALIGN);
+    if (map_slab(pool, pool->buf_size * nbufs, flags) < 0) {
+        int saved = errno;
+        free(pool->bufs);
+        free(pool);
+        errno = saved;
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->freed, NULL);
+
+    /* Thread the free list so buffers are handed out in address order. */
+    for (unsigned i = nbufs; i-- > 0;) {
+        struct pool_buf *b = &pool->bufs[i];
+        b->data = (uint8_t *)pool->slab + (size_t)i * pool->buf_size;
+        b->size = pool->buf_size;
+        b->index = i;
+        b->pool = pool;
+        atomic_init(&b->refs, 0);
+        b->next_free = pool->free_list;
+        pool->free_list = b;
+    }
+    return pool;
+}
+
+void buf_pool_destroy(struct buf_pool *pool) {
+    if (!pool)
+        return;
+    munmap(pool->slab, pool->slab_bytes);
+    pthread_cond_destroy(&pool->freed);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->bufs);
+    free(pool);
+}
+
+/* Called with pool->lock held and a non-empty free list. */
+static struct pool_buf *take_locked(struct buf_pool *pool) {
+    struct pool_buf *b = pool->free_list;
+    pool->free_list = b->next_free;
+    b->next_free = NULL;
+    b->len = 0;
+    b->offset = 0;
+    atomic_store_explicit(&b->refs, 1, memory_order_relaxed);
+
+    pool->gets++;
+    if (++pool->in_use > pool->peak_in_use)
+        pool->peak_in_use = pool->in_use;
+    return b;
+}
+
+struct pool_buf *buf_get(struct buf_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->free_list) {
+        uint64_t t0 = now_ns();
+        pool->stalls++;
+        while (!pool->free_list)
+            pthread_cond_wait(&pool->freed, &pool->lock);
+        pool->stall_ns += now_ns() - t0;
+    }
+    struct pool_buf *b = take_locked(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return b;
+}
+
+struct pool_buf *buf_tryget(struct buf_pool *pool) {
+    struct pool_buf *b = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_list)
+        b = take_locked(pool);
+    else
+        pool->tryget_fails++;
+    pthread_mutex_unlock(&pool->lock);
+    return b;
+}
+
+void buf_put(struct pool_buf *b) {
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    struct buf_pool *pool = b->pool;
+    pthread_mutex_lock(&pool->lock);
+    b->next_free = pool->free_list;
+    pool->free_list = b;
+    pool->in_use--;
+    pthread_cond_signal(&pool->freed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+unsigned buf_pool_count(const struct buf_pool *pool) {
+    return pool->nbufs;
+}
+
+size_t buf_pool_buf_size(const struct buf_pool *pool) {
+    return pool->buf_size;
+}
+
+struct pool_buf *buf_pool_slot(struct buf_pool *pool, unsigned index) {
+    return index < pool->nbufs ? &pool->bufs[index] : NULL;
+}
+
+void buf_pool_get_stats(struct buf_pool *pool, struct buf_pool_stats *st) {
+    pthread_mutex_lock(&pool->lock);
+    st->backing = pool->backing;
+    st->slab_bytes = pool->slab_bytes;
+    st->nbufs = pool->nbufs;
+    st->in_use = pool->in_use;
+    st->peak_in_use = pool->peak_in_use;
+    st->gets = pool->gets;
+    st->stalls = pool->stalls;
+    st->stall_ns = pool->stall_ns;
+    st->tryget_fails = pool->tryget_fails;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void buf_pool_print_stats(struct buf_pool *pool, FILE *out) {
+    static const char *const backing_names[] = {
+        [BUF_POOL_BACKING_HUGE_1G] = "hugetlb 1G",
+        [BUF_POOL_BACKING_HUGE_2M] = "hugetlb 2M",
+        [BUF_POOL_BACKING_THP]     = "THP",
+    };
+    struct buf_pool_stats st;
+    buf_pool_get_stats(pool, &st);
+    fprintf(out, "Buffer pool: %u x %zu KiB (%s, %.1f MiB slab), peak %u/%u in use, "
+                 "%llu gets, %llu stalls (%.3f ms), %llu failed trygets\n",
+            st.nbufs, pool->buf_size / 1024, backing_names[st.backing],
+            (double)st.slab_bytes / (1024.0 * 1024.0), st.peak_in_use, st.nbufs,
+            (unsigned long long)st.gets, (unsigned long long)st.stalls,
+            (double)st.stall_ns / 1e6, (unsigned long long)st.tryget_fails);
+}
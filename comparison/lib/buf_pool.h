@@ -0,0 +1,92 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Pool of fixed-size I/O buffers carved out of one preallocated slab.
+ *
+ * The slab is mapped with 2 MiB hugetlb pages (1 GiB pages for slabs that
+ * nearly fill them) when the system has them reserved, falls back to
+ * transparent hugepages otherwise, and is always prefaulted so the hot loop
+ * never takes a first-touch page fault. Every buffer starts on a
+ * BUF_POOL_ALIGN boundary and its capacity is a multiple of it, so buffers
+ * can be handed straight to O_DIRECT read()/write().
+ *
+ * Buffers are reference counted: a read stage gets a buffer, fills it and
+ * passes it on; a compute or write stage that needs to keep it takes a
+ * reference with buf_ref(). The buffer returns to the pool on the last
+ * buf_put(), so stages hand over ownership instead of copying payloads.
+ */
+
+#define BUF_POOL_ALIGN 4096
+
+/* buf_pool_create() flags. Hugetlb sizes are tried largest first. */
+#define BUF_POOL_HUGE_1G  (1u << 0)
+#define BUF_POOL_HUGE_2M  (1u << 1)
+#define BUF_POOL_DEFAULT  (BUF_POOL_HUGE_1G | BUF_POOL_HUGE_2M)
+
+enum buf_pool_backing {
+    BUF_POOL_BACKING_HUGE_1G,
+    BUF_POOL_BACKING_HUGE_2M,
+    BUF_POOL_BACKING_THP,    /* regular mapping with MADV_HUGEPAGE */
+};
+
+struct buf_pool;
+
+struct pool_buf {
+    uint8_t         *data;
+    size_t           size;     /* capacity, multiple of BUF_POOL_ALIGN */
+    size_t           len;      /* valid payload bytes, set by the producer */
+    off_t            offset;   /* device offset the payload belongs to */
+    unsigned         index;    /* stable slot number, for per-slot registration */
+    atomic_uint      refs;
+    struct buf_pool *pool;
+    struct pool_buf *next_free;
+};
+
+struct buf_pool_stats {
+    enum buf_pool_backing backing;
+    size_t   slab_bytes;
+    unsigned nbufs;
+    unsigned in_use;
+    unsigned peak_in_use;
+    uint64_t gets;           /* successful buf_get()/buf_tryget() calls */
+    uint64_t stalls;         /* buf_get() calls that had to wait */
+    uint64_t stall_ns;       /* total time spent waiting in buf_get() */
+    uint64_t tryget_fails;   /* buf_tryget() calls that found the pool empty */
+};
+
+/*
+ * Create a pool of `nbufs` buffers of at least `buf_size` bytes each.
+ * Returns NULL with errno set on failure.
+ */
+struct buf_pool *buf_pool_create(size_t buf_size, unsigned nbufs, unsigned flags);
+void buf_pool_destroy(struct buf_pool *pool);
+
+/* Block until a buffer is free. The returned buffer holds one reference. */
+struct pool_buf *buf_get(struct buf_pool *pool);
+/* Like buf_get() but returns NULL instead of waiting. */
+struct pool_buf *buf_tryget(struct buf_pool *pool);
+
+static inline struct pool_buf *buf_ref(struct pool_buf *b) {
+    atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+    return b;
+}
+
+/* Drop one reference; the last one returns the buffer to its pool. */
+void buf_put(struct pool_buf *b);
+
+unsigned buf_pool_count(const struct buf_pool *pool);
+size_t buf_pool_buf_size(const struct buf_pool *pool);
+/* Slot `index` regardless of whether it is in use, for one-time registration. */
+struct pool_buf *buf_pool_slot(struct buf_pool *pool, unsigned index);
+
+void buf_pool_get_stats(struct buf_pool *pool, struct buf_pool_stats *st);
+void buf_pool_print_stats(struct buf_pool *pool, FILE *out);
+
+#endif
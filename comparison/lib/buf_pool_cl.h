@@ -0,0 +1,51 @@
+#ifndef BUF_POOL_CL_H
+#define BUF_POOL_CL_H
+
+#include <CL/cl.h>
+#include <stdlib.h>
+
+#include "buf_pool.h"
+
+/*
+ * Optional OpenCL registration for a buffer pool. Header-only so that only
+ * the tools that already include <CL/cl.h> pull it in.
+ *
+ * Every slot is wrapped in a CL_MEM_USE_HOST_PTR buffer, indexed by
+ * pool_buf.index, so the runtime transfers straight from the page-aligned,
+ * prefaulted slab instead of staging through its own copy. Access the slot
+ * only while it is mapped with clEnqueueMapBuffer() (the mapping returns
+ * pool_buf.data) and unmap it before a kernel uses the buffer.
+ */
+
+/* Returns an array of buf_pool_count() buffers, or NULL with *err set. */
+static inline cl_mem *buf_pool_cl_register(struct buf_pool *pool, cl_context ctx,
+                                           cl_mem_flags flags, cl_int *err) {
+    unsigned n = buf_pool_count(pool);
+    cl_mem *mems = calloc(n, sizeof(*mems));
+    if (!mems) {
+        *err = CL_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        struct pool_buf *slot = buf_pool_slot(pool, i);
+        mems[i] = clCreateBuffer(ctx, flags | CL_MEM_USE_HOST_PTR, slot->size, slot->data, err);
+        if (*err != CL_SUCCESS) {
+            while (i--)
+                clReleaseMemObject(mems[i]);
+            free(mems);
+            return NULL;
+        }
+    }
+    *err = CL_SUCCESS;
+    return mems;
+}
+
+static inline void buf_pool_cl_release(struct buf_pool *pool, cl_mem *mems) {
+    if (!mems)
+        return;
+    for (unsigned i = 0; i < buf_pool_count(pool); i++)
+        clReleaseMemObject(mems[i]);
+    free(mems);
+}
+
+#endif
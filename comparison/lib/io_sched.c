@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include "io_sched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Adaptive ceiling when none is configured; far above any real array. */
+#define IO_SCHED_MAX_RATE (64ull << 30)
+
+/* Probe reads per control window when standing in for foreground traffic. */
+#define PROBES_PER_WINDOW 10
+
+/* Upper bound for -l; anything larger never backs off in practice. */
+#define IO_SCHED_MAX_TARGET_US 10000000ull
+
+struct bucket {
+    uint64_t rate_bps;   /* 0 = unlimited */
+    double   tokens;     /* may go negative: a large request borrows ahead */
+    uint64_t last_ns;
+};
+
+struct io_sched {
+    pthread_mutex_t        lock;
+    struct io_sched_config cfg;
+    struct bucket          buckets[IO_NR_CLASSES];
+    uint64_t               last_probe_ns;
+
+    /* Current control window. */
+    uint64_t window_start_ns;
+    uint64_t win_fg_reads;
+    uint64_t win_fg_read_ns;
+
+    struct io_sched_stats stats;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static double bucket_depth(const struct io_sched *s, uint64_t rate_bps) {
+    if (s->cfg.burst_bytes)
+        return (double)s->cfg.burst_bytes;
+    return (double)rate_bps * s->cfg.window_ms / 1000.0;
+}
+
+static void bucket_refill(struct io_sched *s, struct bucket *b, uint64_t now) {
+    double depth = bucket_depth(s, b->rate_bps);
+    b->tokens += (double)b->rate_bps * (double)(now - b->last_ns) / 1e9;
+    if (b->tokens > depth)
+        b->tokens = depth;
+    b->last_ns = now;
+}
+
+/* Re-evaluate the background rate at the end of each control window. */
+static void adapt_locked(struct io_sched *s, uint64_t now) {
+    uint64_t window_ns = (uint64_t)s->cfg.window_ms * 1000000ull;
+    if (now - s->window_start_ns < window_ns)
+        return;
+
+    struct bucket *bg = &s->buckets[IO_CLASS_BG];
+    uint64_t rate = bg->rate_bps;
+    uint64_t ceiling = s->cfg.max_bg_bps;
+
+    if (s->win_fg_reads == 0) {
+        /* Array is idle as far as foreground is concerned: ramp quickly. */
+        rate *= 2;
+        s->stats.fg_read_lat_us = 0;
+        s->stats.rampups++;
+    } else {
+        uint64_t mean_us = s->win_fg_read_ns / s->win_fg_reads / 1000;
+        s->stats.fg_read_lat_us = mean_us;
+        if (mean_us > s->cfg.target_lat_us) {
+            rate /= 2;
+            s->stats.backoffs++;
+        } else {
+            rate += s->cfg.min_bg_bps;
+            s->stats.rampups++;
+        }
+    }
+
+    if (rate < s->cfg.min_bg_bps)
+        rate = s->cfg.min_bg_bps;
+    if (rate > ceiling)
+        rate = ceiling;
+
+    bucket_refill(s, bg, now);
+    bg->rate_bps = rate;
+    s->stats.bg_rate_bps = rate;
+
+    s->window_start_ns = now;
+    s->win_fg_reads = 0;
+    s->win_fg_read_ns = 0;
+}
+
+void io_sched_config_init(struct io_sched_config *cfg) {
+    *cfg = (struct io_sched_config){
+        .target_lat_us = 2000,
+        .min_bg_bps = 16ull << 20,
+        .window_ms = 100,
+    };
+}
+
+static int parse_u64(const char *arg, uint64_t max, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (arg[0] == '-' || end == arg || *end || errno || v == 0 || v > max)
+        return -1;
+    *out = v;
+    return 0;
+}
+
+int io_sched_parse_opt(struct io_sched_config *cfg, int opt, const char *arg) {
+    uint64_t v;
+    switch (opt) {
+    case 'r':
+        if (parse_u64(arg, IO_SCHED_MAX_RATE >> 20, &v) < 0) {
+            fprintf(stderr, "Invalid rate '%s': expected 1..%llu MiB/s\n", arg,
+                    IO_SCHED_MAX_RATE >> 20);
+            return -1;
+        }
+        cfg->rate_bps[IO_CLASS_BG] = v << 20;
+        cfg->max_bg_bps = v << 20;
+        return 1;
+    case 'l':
+        if (parse_u64(arg, IO_SCHED_MAX_TARGET_US, &v) < 0) {
+            fprintf(stderr, "Invalid latency target '%s': expected 1..%llu us\n", arg,
+                    IO_SCHED_MAX_TARGET_US);
+            return -1;
+        }
+        cfg->adaptive = 1;
+        cfg->target_lat_us = v;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+struct io_sched *io_sched_create(const struct io_sched_config *cfg) {
+    if (cfg->window_ms == 0 || (cfg->adaptive && cfg->min_bg_bps == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct io_sched *s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    s->cfg = *cfg;
+    pthread_mutex_init(&s->lock, NULL);
+
+    uint64_t now = now_ns();
+    for (int c = 0; c < IO_NR_CLASSES; c++) {
+        s->buckets[c].rate_bps = cfg->rate_bps[c];
+        s->buckets[c].tokens = bucket_depth(s, cfg->rate_bps[c]);
+        s->buckets[c].last_ns = now;
+    }
+    if (cfg->adaptive) {
+        if (s->cfg.max_bg_bps == 0)
+            s->cfg.max_bg_bps = IO_SCHED_MAX_RATE;
+        if (s->cfg.min_bg_bps > s->cfg.max_bg_bps)
+            s->cfg.min_bg_bps = s->cfg.max_bg_bps;
+        if (s->buckets[IO_CLASS_BG].rate_bps == 0)
+            s->buckets[IO_CLASS_BG].rate_bps = cfg->min_bg_bps;
+    }
+    s->stats.bg_rate_bps = s->buckets[IO_CLASS_BG].rate_bps;
+    s->window_start_ns = now;
+    return s;
+}
+
+void io_sched_destroy(struct io_sched *s) {
+    if (!s)
+        return;
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+void io_sched_admit(struct io_sched *s, enum io_class cls, size_t len) {
+    pthread_mutex_lock(&s->lock);
+    uint64_t now = now_ns();
+    if (s->cfg.adaptive)
+        adapt_locked(s, now);
+
+    struct bucket *b = &s->buckets[cls];
+    uint64_t debt_ns = 0;
+    if (b->rate_bps) {
+        bucket_refill(s, b, now);
+        b->tokens -= (double)len;
+        if (b->tokens < 0)
+            debt_ns = (uint64_t)(-b->tokens * 1e9 / (double)b->rate_bps);
+    }
+    s->stats.ops[cls]++;
+    s->stats.bytes[cls] += len;
+    s->stats.throttle_ns[cls] += debt_ns;
+    pthread_mutex_unlock(&s->lock);
+
+    if (debt_ns)
+        sleep_ns(debt_ns);
+}
+
+void io_sched_complete(struct io_sched *s, enum io_class cls, int is_read, size_t len,
+                       ssize_t done, uint64_t lat_ns) {
+    size_t moved = done > 0 ? (size_t)done : 0;
+    size_t unused = moved < len ? len - moved : 0;
+    int fg_read = cls == IO_CLASS_FG && is_read;
+    if (!unused && !fg_read)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    if (unused) {
+        /* Short read at EOF or a failed call: charge only what moved. */
+        struct bucket *b = &s->buckets[cls];
+        if (b->rate_bps) {
+            b->tokens += (double)unused;
+            if (b->tokens > bucket_depth(s, b->rate_bps))
+                b->tokens = bucket_depth(s, b->rate_bps);
+        }
+        s->stats.bytes[cls] -= unused;
+    }
+    if (fg_read) {
+        s->win_fg_reads++;
+        s->win_fg_read_ns += lat_ns;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+ssize_t io_sched_read(struct io_sched *s, enum io_class cls, int fd, void *buf, size_t len) {
+    io_sched_admit(s, cls, len);
+    uint64_t t0 = now_ns();
+    ssize_t r = read(fd, buf, len);
+    io_sched_complete(s, cls, 1, len, r, now_ns() - t0);
+    return r;
+}
+
+ssize_t io_sched_write(struct io_sched *s, enum io_class cls, int fd, const void *buf, size_t len) {
+    io_sched_admit(s, cls, len);
+    uint64_t t0 = now_ns();
+    ssize_t r = write(fd, buf, len);
+    io_sched_complete(s, cls, 0, len, r, now_ns() - t0);
+    return r;
+}
+
+ssize_t io_sched_pread(struct io_sched *s, enum io_class cls, int fd, void *buf, size_t len, off_t off) {
+    io_sched_admit(s, cls, len);
+    uint64_t t0 = now_ns();
+    ssize_t r = pread(fd, buf, len, off);
+    io_sched_complete(s, cls, 1, len, r, now_ns() - t0);
+    return r;
+}
+
+int io_sched_probe(struct io_sched *s, int fd, void *buf, off_t dev_size) {
+    uint64_t now = now_ns();
+    uint64_t interval = (uint64_t)s->cfg.window_ms * 1000000ull / PROBES_PER_WINDOW;
+
+    pthread_mutex_lock(&s->lock);
+    int due = now - s->last_probe_ns >= interval;
+    if (due)
+        s->last_probe_ns = now;
+    pthread_mutex_unlock(&s->lock);
+    if (!due || dev_size < IO_SCHED_PROBE_SIZE)
+        return 0;
+
+    off_t off = (off_t)(random() % (dev_size / IO_SCHED_PROBE_SIZE)) * IO_SCHED_PROBE_SIZE;
+    ssize_t r = io_sched_pread(s, IO_CLASS_FG, fd, buf, IO_SCHED_PROBE_SIZE, off);
+    return r < 0 ? -1 : 1;
+}
+
+void io_sched_get_stats(struct io_sched *s, struct io_sched_stats *st) {
+    pthread_mutex_lock(&s->lock);
+    *st = s->stats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void io_sched_print_stats(struct io_sched *s, FILE *out) {
+    static const char *const class_names[IO_NR_CLASSES] = { "fg", "bg" };
+    struct io_sched_stats st;
+    io_sched_get_stats(s, &st);
+
+    fprintf(out, "I/O scheduler:");
+    for (int c = 0; c < IO_NR_CLASSES; c++) {
+        if (!st.ops[c])
+            continue;
+        fprintf(out, " %s %llu ops / %.2f MiB (throttled %.3f s)", class_names[c],
+                (unsigned long long)st.ops[c], (double)st.bytes[c] / (1024.0 * 1024.0),
+                (double)st.throttle_ns[c] / 1e9);
+    }
+    fprintf(out, "\n");
+    if (s->cfg.adaptive)
+        fprintf(out, "  adaptive: bg rate %.1f MiB/s, fg read latency %llu us (target %llu us), "
+                     "%llu backoffs, %llu ramp-ups\n",
+                (double)st.bg_rate_bps / (1024.0 * 1024.0), (unsigned long long)st.fg_read_lat_us,
+                (unsigned long long)s->cfg.target_lat_us, (unsigned long long)st.backoffs,
+                (unsigned long long)st.rampups);
+}
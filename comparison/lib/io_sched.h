@@ -0,0 +1,98 @@
+#ifndef IO_SCHED_H
+#define IO_SCHED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * I/O QoS scheduler for the XOR tools.
+ *
+ * Every read or write is issued on behalf of a priority class and first
+ * passes that class's token bucket. Foreground I/O is normally unlimited and
+ * only measured. Background I/O (rebuild, full-device XOR) is rate limited.
+ *
+ * In adaptive mode the background rate is driven by foreground read latency.
+ * Once per control window, the rate is halved if the mean foreground read
+ * latency exceeded `target_lat_us`. It grows by `min_bg_bps` if latency was
+ * within target, and doubles if there was no foreground traffic at all. A
+ * standalone job with no real foreground traffic can time small
+ * IO_CLASS_FG probe reads to stand in for it.
+ */
+
+enum io_class {
+    IO_CLASS_FG,
+    IO_CLASS_BG,
+    IO_NR_CLASSES,
+};
+
+struct io_sched_config {
+    uint64_t rate_bps[IO_NR_CLASSES];  /* 0 = unlimited; initial BG rate in adaptive mode */
+    uint64_t burst_bytes;              /* bucket depth, 0 = one control window worth */
+
+    int      adaptive;
+    uint64_t target_lat_us;            /* FG read latency SLO */
+    uint64_t min_bg_bps;               /* adaptive floor, so background always progresses */
+    uint64_t max_bg_bps;               /* adaptive ceiling, 0 = unlimited */
+    unsigned window_ms;                /* control interval */
+};
+
+struct io_sched_stats {
+    uint64_t ops[IO_NR_CLASSES];
+    uint64_t bytes[IO_NR_CLASSES];
+    uint64_t throttle_ns[IO_NR_CLASSES];  /* time spent waiting for tokens */
+    uint64_t bg_rate_bps;                  /* current background rate, 0 = unlimited */
+    uint64_t fg_read_lat_us;               /* mean FG read latency of the last window */
+    uint64_t backoffs, rampups;
+};
+
+struct io_sched;
+
+/* Fill `cfg` with defaults: no limits, 100 ms windows, 2 ms latency target. */
+void io_sched_config_init(struct io_sched_config *cfg);
+
+/* getopt() letters shared by the XOR tools, and the matching usage lines. */
+#define IO_SCHED_OPTS "r:l:"
+#define IO_SCHED_USAGE \
+    "  -r MiB/s      cap background I/O, reads plus writes (adaptive ceiling with -l)\n" \
+    "  -l target_us  adapt throughput to keep probed read latency under target_us\n"
+
+/*
+ * Apply one IO_SCHED_OPTS option to `cfg`. Returns 1 if it was applied, 0 if
+ * `opt` is not a scheduler option, -1 after printing why `arg` is invalid.
+ */
+int io_sched_parse_opt(struct io_sched_config *cfg, int opt, const char *arg);
+
+/* Returns NULL with errno set on failure. */
+struct io_sched *io_sched_create(const struct io_sched_config *cfg);
+void io_sched_destroy(struct io_sched *s);
+
+/* Reserve `len` bytes of class `cls`, waiting until they may be issued. */
+void io_sched_admit(struct io_sched *s, enum io_class cls, size_t len);
+/*
+ * Record a completed operation that was admitted for `len` bytes and
+ * returned `done` (a byte count or -1). Bytes that were not transferred are
+ * returned to the bucket; the latency feeds the adaptive controller.
+ */
+void io_sched_complete(struct io_sched *s, enum io_class cls, int is_read, size_t len,
+                       ssize_t done, uint64_t lat_ns);
+
+/* Admit, issue and time one operation; same return values as the syscalls. */
+ssize_t io_sched_read(struct io_sched *s, enum io_class cls, int fd, void *buf, size_t len);
+ssize_t io_sched_write(struct io_sched *s, enum io_class cls, int fd, const void *buf, size_t len);
+ssize_t io_sched_pread(struct io_sched *s, enum io_class cls, int fd, void *buf, size_t len, off_t off);
+
+#define IO_SCHED_PROBE_SIZE 4096
+
+/*
+ * Issue one timed IO_CLASS_FG read of IO_SCHED_PROBE_SIZE bytes at a random
+ * aligned offset below `dev_size`, at most ten times per control window.
+ * `buf` must be suitably aligned for `fd`. Returns 1 if a probe was issued,
+ * 0 if none was due, -1 on read error.
+ */
+int io_sched_probe(struct io_sched *s, int fd, void *buf, off_t dev_size);
+
+void io_sched_get_stats(struct io_sched *s, struct io_sched_stats *st);
+void io_sched_print_stats(struct io_sched *s, FILE *out);
+
+#endif
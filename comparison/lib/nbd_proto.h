@@ -0,0 +1,51 @@
+#ifndef NBD_PROTO_H
+#define NBD_PROTO_H
+
+#include <linux/nbd.h>
+#include <stdint.h>
+
+/*
+ * Fixed-newstyle NBD handshake constants that <linux/nbd.h> does not carry.
+ * Transmission-phase magics, commands and flags come from that header. All
+ * integers on the wire are big-endian.
+ */
+
+#define NBD_INIT_MAGIC      0x4e42444d41474943ull  /* "NBDMAGIC" */
+#define NBD_OPTS_MAGIC      0x49484156454f5054ull  /* "IHAVEOPT" */
+#define NBD_REP_MAGIC       0x0003e889045565a9ull
+
+/* Handshake flags (server) and client flags. */
+#define NBD_FLAG_FIXED_NEWSTYLE   (1 << 0)
+#define NBD_FLAG_NO_ZEROES        (1 << 1)
+#define NBD_FLAG_C_FIXED_NEWSTYLE NBD_FLAG_FIXED_NEWSTYLE
+#define NBD_FLAG_C_NO_ZEROES      NBD_FLAG_NO_ZEROES
+
+#define NBD_OPT_EXPORT_NAME 1
+#define NBD_OPT_ABORT       2
+#define NBD_OPT_INFO        6
+#define NBD_OPT_GO          7
+
+#define NBD_REP_ACK         1
+#define NBD_REP_INFO        3
+#define NBD_REP_ERR_UNSUP   0x80000001u
+#define NBD_REP_ERR_INVALID 0x80000003u
+
+#define NBD_INFO_EXPORT     0
+#define NBD_INFO_BLOCK_SIZE 3
+
+struct nbd_wire_request {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t type;
+    uint64_t handle;
+    uint64_t offset;
+    uint32_t length;
+} __attribute__((packed));
+
+struct nbd_wire_reply {
+    uint32_t magic;
+    uint32_t error;
+    uint64_t handle;
+} __attribute__((packed));
+
+#endif
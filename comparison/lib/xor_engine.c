@@ -0,0 +1,7 @@
+#include "xor_engine.h"
+
+void xor_buffers(uint8_t *dst, const uint8_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] ^= src[i];
+    }
+}
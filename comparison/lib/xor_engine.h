@@ -0,0 +1,17 @@
+#ifndef XOR_ENGINE_H
+#define XOR_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CPU XOR shared by xor and nbd_server: the byte loop xor.c has always
+ * used, left for the compiler to vectorise. The OpenCL kernels in
+ * xor_opencl/xor_on_gpu and the C++ ParityEngine under experiments/ are
+ * separate engines and are not used through this header.
+ *
+ * dst ^= src over n bytes. Buffers may be unaligned but must not overlap.
+ */
+void xor_buffers(uint8_t *dst, const uint8_t *src, size_t n);
+
+#endif
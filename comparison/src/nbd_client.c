@@ -0,0 +1,453 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nbd_proto.h"
+
+/*
+ * Userspace NBD client for exercising nbd_server without the kernel nbd
+ * module. Keeps up to -q requests in flight (a sender and a receiver thread)
+ * and reports IOPS and latency percentiles.
+ *
+ *   verify    write a deterministic pattern over the first -n blocks, read it back
+ *   readback  only the read-back half of verify, e.g. against a degraded array
+ *   bench     random -b sized I/O, -w percent writes, for -n ops or -T seconds
+ *   trace     replay "R|W <offset> <length>" lines from -t
+ */
+
+#define DEFAULT_SOCKET "/tmp/gpu-raid.sock"
+#define MAX_DEPTH      256
+#define MAX_PAYLOAD    (1024 * 1024)
+
+enum mode { MODE_VERIFY, MODE_READBACK, MODE_BENCH, MODE_TRACE };
+
+struct slot {
+    int       busy;
+    uint16_t  type;
+    uint64_t  offset;
+    uint32_t  len;
+    uint64_t  t_send;
+    uint8_t  *buf;
+};
+
+struct client {
+    int      sock;
+    uint64_t size;
+    unsigned depth;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  freed;
+    struct slot     slots[MAX_DEPTH];
+    unsigned        in_flight;
+    int             check_reads;
+
+    /* Owned by the receiver thread until it is joined. */
+    uint64_t *lat;
+    size_t    nlat, cap;
+    uint64_t  completed, errors, mismatches, bytes;
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* Content of the device at `off` as written by this tool: a hash of the offset. */
+static inline uint64_t pattern_word(uint64_t off) {
+    uint64_t z = off + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void fill_pattern(uint8_t *buf, uint64_t off, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += 8) {
+        uint64_t w = pattern_word(off + i);
+        memcpy(buf + i, &w, len - i < 8 ? len - i : 8);
+    }
+}
+
+static int check_pattern(const uint8_t *buf, uint64_t off, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += 8) {
+        uint64_t w = pattern_word(off + i);
+        if (memcmp(buf + i, &w, len - i < 8 ? len - i : 8) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int handshake(int sock, uint64_t *size) {
+    struct {
+        uint64_t init, opts;
+        uint16_t flags;
+    } __attribute__((packed)) hello;
+    if (read_full(sock, &hello, sizeof(hello)) < 0 ||
+        be64toh(hello.init) != NBD_INIT_MAGIC || be64toh(hello.opts) != NBD_OPTS_MAGIC ||
+        !(be16toh(hello.flags) & NBD_FLAG_FIXED_NEWSTYLE)) {
+        fprintf(stderr, "Server does not speak fixed-newstyle NBD\n");
+        return -1;
+    }
+
+    uint32_t cflags = htobe32(NBD_FLAG_C_FIXED_NEWSTYLE | NBD_FLAG_C_NO_ZEROES);
+    /* NBD_OPT_GO for the default export, no info requests. */
+    struct {
+        uint32_t cflags;
+        uint64_t magic;
+        uint32_t opt, len;
+        uint32_t name_len;
+        uint16_t nreq;
+    } __attribute__((packed)) go = {
+        cflags, htobe64(NBD_OPTS_MAGIC), htobe32(NBD_OPT_GO), htobe32(6), 0, 0,
+    };
+    if (write_full(sock, &go, sizeof(go)) < 0)
+        return -1;
+
+    for (;;) {
+        struct {
+            uint64_t magic;
+            uint32_t opt, type, len;
+        } __attribute__((packed)) rep;
+        uint8_t data[256];
+        if (read_full(sock, &rep, sizeof(rep)) < 0 || be64toh(rep.magic) != NBD_REP_MAGIC)
+            return -1;
+        uint32_t type = be32toh(rep.type), len = be32toh(rep.len);
+        if (len > sizeof(data) || (len && read_full(sock, data, len) < 0))
+            return -1;
+
+        if (type == NBD_REP_ACK)
+            return 0;
+        if (type & 0x80000000u) {
+            fprintf(stderr, "Server rejected NBD_OPT_GO (0x%x)\n", type);
+            return -1;
+        }
+        uint16_t info;
+        memcpy(&info, data, 2);
+        if (type == NBD_REP_INFO && len >= 12 && be16toh(info) == NBD_INFO_EXPORT) {
+            memcpy(size, data + 2, 8);
+            *size = be64toh(*size);
+        }
+    }
+}
+
+static void disconnect(int sock) {
+    struct nbd_wire_request disc = {
+        .magic = htobe32(NBD_REQUEST_MAGIC),
+        .type = htobe16(NBD_CMD_DISC),
+    };
+    write_full(sock, &disc, sizeof(disc));
+    shutdown(sock, SHUT_WR);
+}
+
+static void *receiver(void *arg) {
+    struct client *c = arg;
+    struct nbd_wire_reply rep;
+
+    while (read_full(c->sock, &rep, sizeof(rep)) == 0) {
+        if (be32toh(rep.magic) != NBD_REPLY_MAGIC || rep.handle >= c->depth) {
+            fprintf(stderr, "Bad reply from server\n");
+            break;
+        }
+        struct slot *s = &c->slots[rep.handle];
+        uint32_t error = be32toh(rep.error);
+        if (s->type == NBD_CMD_READ && !error) {
+            if (read_full(c->sock, s->buf, s->len) < 0)
+                break;
+            if (c->check_reads && check_pattern(s->buf, s->offset, s->len) < 0) {
+                if (c->mismatches++ < 8)
+                    fprintf(stderr, "Data mismatch in %u bytes at offset %llu\n", s->len,
+                            (unsigned long long)s->offset);
+            }
+        }
+
+        if (c->nlat == c->cap) {
+            c->cap = c->cap ? 2 * c->cap : 4096;
+            c->lat = realloc(c->lat, c->cap * sizeof(*c->lat));
+        }
+        c->lat[c->nlat++] = now_ns() - s->t_send;
+        c->completed++;
+        c->bytes += s->len;
+        if (error) {
+            if (c->errors++ < 8)
+                fprintf(stderr, "Request at offset %llu failed: %s\n",
+                        (unsigned long long)s->offset, strerror(error));
+        }
+
+        pthread_mutex_lock(&c->lock);
+        s->busy = 0;
+        c->in_flight--;
+        pthread_cond_signal(&c->freed);
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    /* Connection gone: release anyone waiting for a slot. */
+    pthread_mutex_lock(&c->lock);
+    c->in_flight = 0;
+    for (unsigned i = 0; i < c->depth; i++)
+        c->slots[i].busy = 0;
+    pthread_cond_broadcast(&c->freed);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static int submit(struct client *c, uint16_t type, uint64_t offset, uint32_t len) {
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight == c->depth)
+        pthread_cond_wait(&c->freed, &c->lock);
+    unsigned i = 0;
+    while (c->slots[i].busy)
+        i++;
+    struct slot *s = &c->slots[i];
+    s->busy = 1;
+    c->in_flight++;
+    pthread_mutex_unlock(&c->lock);
+
+    s->type = type;
+    s->offset = offset;
+    s->len = type == NBD_CMD_FLUSH ? 0 : len;
+    if (type == NBD_CMD_WRITE)
+        fill_pattern(s->buf, offset, len);
+
+    struct nbd_wire_request req = {
+        .magic = htobe32(NBD_REQUEST_MAGIC),
+        .type = htobe16(type),
+        .handle = i,
+        .offset = htobe64(offset),
+        .length = htobe32(s->len),
+    };
+    s->t_send = now_ns();
+    if (write_full(c->sock, &req, sizeof(req)) < 0)
+        return -1;
+    if (type == NBD_CMD_WRITE && write_full(c->sock, s->buf, len) < 0)
+        return -1;
+    return 0;
+}
+
+static void drain(struct client *c) {
+    pthread_mutex_lock(&c->lock);
+    while (c->in_flight)
+        pthread_cond_wait(&c->freed, &c->lock);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *phase, struct client *c, uint64_t t0, uint64_t done0, size_t lat0,
+                   uint64_t bytes0) {
+    double elapsed = (now_ns() - t0) / 1e9;
+    uint64_t ops = c->completed - done0;
+    size_t n = c->nlat - lat0;
+    uint64_t *lat = c->lat + lat0;
+    if (!n)
+        return;
+    qsort(lat, n, sizeof(*lat), cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += lat[i];
+    printf("%-9s %llu ops in %.3f s => %.0f IOPS, %.2f MiB/s; latency us: mean %.1f, "
+           "p50 %.1f, p99 %.1f, max %.1f\n",
+           phase, (unsigned long long)ops, elapsed, ops / elapsed,
+           (double)(c->bytes - bytes0) / (1024.0 * 1024.0) / elapsed, (double)sum / n / 1e3,
+           lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-s socket] [-m verify|readback|bench|trace] [-q depth] [-b block_kib]\n"
+            "          [-n count] [-w write_pct] [-T seconds] [-t tracefile]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *sock_path = DEFAULT_SOCKET;
+    const char *trace_path = NULL;
+    enum mode mode = MODE_VERIFY;
+    unsigned depth = 32;
+    uint32_t block = 64 * 1024;
+    uint64_t count = 0;
+    unsigned write_pct = 30;
+    double seconds = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:m:q:b:n:w:T:t:")) != -1) {
+        switch (opt) {
+        case 's': sock_path = optarg; break;
+        case 'm':
+            if (!strcmp(optarg, "verify")) mode = MODE_VERIFY;
+            else if (!strcmp(optarg, "readback")) mode = MODE_READBACK;
+            else if (!strcmp(optarg, "bench")) mode = MODE_BENCH;
+            else if (!strcmp(optarg, "trace")) mode = MODE_TRACE;
+            else { usage(argv[0]); return EXIT_FAILURE; }
+            break;
+        case 'q': depth = strtoul(optarg, NULL, 10); break;
+        case 'b': block = strtoul(optarg, NULL, 10) * 1024; break;
+        case 'n': count = strtoull(optarg, NULL, 10); break;
+        case 'w': write_pct = strtoul(optarg, NULL, 10); break;
+        case 'T': seconds = strtod(optarg, NULL); break;
+        case 't': trace_path = optarg; mode = MODE_TRACE; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (depth < 1 || depth > MAX_DEPTH || block < 512 || block > MAX_PAYLOAD ||
+        (mode == MODE_TRACE && !trace_path)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    struct client c = { .sock = sock, .depth = depth };
+    if (handshake(sock, &c.size) < 0) {
+        close(sock);
+        return EXIT_FAILURE;
+    }
+    printf("Connected: %.2f GiB export, queue depth %u\n",
+           (double)c.size / (1024.0 * 1024.0 * 1024.0), depth);
+    if (mode != MODE_TRACE && block > c.size) {
+        fprintf(stderr, "Block size %u exceeds the %llu-byte export\n", block,
+                (unsigned long long)c.size);
+        disconnect(sock);
+        close(sock);
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.freed, NULL);
+    for (unsigned i = 0; i < depth; i++) {
+        c.slots[i].buf = malloc(MAX_PAYLOAD);
+        if (!c.slots[i].buf) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_t rx;
+    pthread_create(&rx, NULL, receiver, &c);
+
+    uint64_t blocks = c.size / block;
+    if (count == 0 || ((mode == MODE_VERIFY || mode == MODE_READBACK) && count > blocks))
+        count = mode == MODE_BENCH ? 10000 : blocks;
+
+    int rc = 0;
+    uint64_t t0 = now_ns();
+    switch (mode) {
+    case MODE_VERIFY:
+        for (uint64_t i = 0; i < count && rc == 0; i++)
+            rc = submit(&c, NBD_CMD_WRITE, i * block, block);
+        if (rc == 0)
+            rc = submit(&c, NBD_CMD_FLUSH, 0, 0);
+        drain(&c);
+        report("write", &c, t0, 0, 0, 0);
+        /* fall through */
+    case MODE_READBACK: {
+        uint64_t t1 = now_ns(), done1 = c.completed, bytes1 = c.bytes;
+        size_t lat1 = c.nlat;
+        c.check_reads = 1;
+        for (uint64_t i = 0; i < count && rc == 0; i++)
+            rc = submit(&c, NBD_CMD_READ, i * block, block);
+        drain(&c);
+        report("read", &c, t1, done1, lat1, bytes1);
+        break;
+    }
+    case MODE_BENCH: {
+        uint64_t deadline = seconds > 0 ? t0 + (uint64_t)(seconds * 1e9) : UINT64_MAX;
+        srandom(1);
+        for (uint64_t i = 0; (seconds > 0 || i < count) && now_ns() < deadline && rc == 0; i++) {
+            uint64_t off = (uint64_t)random() % blocks * block;
+            uint16_t type = (unsigned)(random() % 100) < write_pct ? NBD_CMD_WRITE : NBD_CMD_READ;
+            rc = submit(&c, type, off, block);
+        }
+        drain(&c);
+        report("bench", &c, t0, 0, 0, 0);
+        break;
+    }
+    case MODE_TRACE: {
+        FILE *f = fopen(trace_path, "r");
+        if (!f) {
+            perror(trace_path);
+            rc = -1;
+            break;
+        }
+        char op;
+        unsigned long long off, len;
+        while (rc == 0 && fscanf(f, " %c %llu %llu", &op, &off, &len) == 3) {
+            if (len == 0 || len > MAX_PAYLOAD || off + len > c.size) {
+                fprintf(stderr, "Skipping trace entry %c %llu %llu\n", op, off, len);
+                continue;
+            }
+            rc = submit(&c, op == 'W' || op == 'w' ? NBD_CMD_WRITE : NBD_CMD_READ, off, len);
+        }
+        fclose(f);
+        drain(&c);
+        report("trace", &c, t0, 0, 0, 0);
+        break;
+    }
+    }
+
+    disconnect(sock);
+    pthread_join(rx, NULL);
+    close(sock);
+
+    if (rc < 0)
+        fprintf(stderr, "Connection lost\n");
+    if (c.errors || c.mismatches)
+        printf("%llu failed requests, %llu mismatched reads\n",
+               (unsigned long long)c.errors, (unsigned long long)c.mismatches);
+    else if (mode == MODE_VERIFY || mode == MODE_READBACK)
+        printf("NO ERRORS FOUND\n");
+
+    for (unsigned i = 0; i < depth; i++)
+        free(c.slots[i].buf);
+    free(c.lat);
+    return rc < 0 || c.errors || c.mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
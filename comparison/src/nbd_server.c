@@ -0,0 +1,845 @@
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buf_pool.h"
+#include "nbd_proto.h"
+#include "xor_engine.h"
+
+/*
+ * NBD server exposing N member devices as one RAID-5 array (left-symmetric
+ * rotating parity) over a Unix domain socket.
+ *
+ * A reader thread decodes requests into pool buffers and queues them; worker
+ * threads pop a request, merge queued requests of the same type that extend
+ * it contiguously, run the merged range against the array and send one reply
+ * per original request. Writes that cover a whole stripe compute parity from
+ * the new data; partial writes do read-modify-write. All parity math uses
+ * the CPU xor_buffers() from xor_engine.h; no GPU path is wired in.
+ *
+ * With -f the given member is treated as failed: reads reconstruct it from
+ * the others and writes keep parity consistent without touching it. Its path
+ * is never opened, so a missing device can be given as any placeholder.
+ */
+
+#define DEFAULT_SOCKET  "/tmp/gpu-raid.sock"
+#define DEFAULT_CHUNK   (64 * 1024)
+#define MAX_REQ         (1024 * 1024)
+#define QUEUE_DEPTH     64
+#define MAX_MEMBERS     32
+#define MAX_WORKERS     64
+#define MAX_MERGE       32
+#define STRIPE_LOCKS    256
+
+struct array {
+    int      fds[MAX_MEMBERS];
+    unsigned n;            /* members, one chunk per stripe holds parity */
+    int      failed;       /* failed member index, or -1 */
+    size_t   chunk;
+    uint64_t stripes;
+    uint64_t size;         /* exported bytes */
+    pthread_mutex_t stripe_locks[STRIPE_LOCKS];
+};
+
+struct request {
+    uint16_t         type;
+    uint64_t         handle;
+    uint64_t         offset;
+    uint32_t         len;
+    uint64_t         t_recv;
+    struct pool_buf *buf;
+    struct request  *next;
+};
+
+struct stats {
+    uint64_t reads, writes, flushes, merged, errors;
+    uint64_t bytes_read, bytes_written;
+    uint64_t full_stripe_writes, rmw_segments, degraded_segments;
+    uint64_t latency_ns;
+};
+
+struct conn {
+    int              sock;
+    struct array    *array;
+    struct buf_pool *pool;
+
+    pthread_mutex_t  qlock;
+    pthread_cond_t   qcond, idle;
+    struct request  *head, *tail;
+    unsigned         in_flight;
+    int              closing;
+
+    pthread_mutex_t  send_lock;
+
+    pthread_mutex_t  stats_lock;
+    struct stats     stats;
+};
+
+struct worker {
+    struct conn     *conn;
+    struct pool_buf *scratch;   /* 2 chunks: old data and parity */
+    pthread_t        thread;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR && !stop)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* ---- array layout and member I/O ------------------------------------- */
+
+static unsigned parity_member(const struct array *a, uint64_t stripe) {
+    return a->n - 1 - (unsigned)(stripe % a->n);
+}
+
+static unsigned data_member(const struct array *a, uint64_t stripe, unsigned d) {
+    return (parity_member(a, stripe) + 1 + d) % a->n;
+}
+
+static int member_read(struct array *a, unsigned m, void *buf, size_t len, off_t off) {
+    uint8_t *p = buf;
+    while (len) {
+        ssize_t r = pread(a->fds[m], p, len, off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r; off += r; len -= r;
+    }
+    return 0;
+}
+
+static int member_write(struct array *a, unsigned m, const void *buf, size_t len, off_t off) {
+    if ((int)m == a->failed)
+        return 0;
+    const uint8_t *p = buf;
+    while (len) {
+        ssize_t w = pwrite(a->fds[m], p, len, off);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w; off += w; len -= w;
+    }
+    return 0;
+}
+
+/* XOR of [off, off+len) on every member except `skip` into buf. */
+static int reconstruct(struct array *a, unsigned skip, uint8_t *buf, uint8_t *tmp,
+                       size_t len, off_t off) {
+    int first = 1;
+    for (unsigned m = 0; m < a->n; m++) {
+        if (m == skip)
+            continue;
+        if (member_read(a, m, first ? buf : tmp, len, off) < 0)
+            return -1;
+        if (!first)
+            xor_buffers(buf, tmp, len);
+        first = 0;
+    }
+    return 0;
+}
+
+/*
+ * Write one segment inside a data chunk, keeping parity consistent.
+ * Caller holds the stripe lock.
+ */
+static int write_segment(struct array *a, struct stats *st, uint64_t stripe, unsigned d,
+                         const uint8_t *data, size_t len, off_t off, uint8_t *old, uint8_t *par) {
+    unsigned dm = data_member(a, stripe, d);
+    unsigned pm = parity_member(a, stripe);
+
+    if ((int)pm == a->failed)
+        return member_write(a, dm, data, len, off);
+
+    if ((int)dm == a->failed) {
+        /* Reconstruct-write: parity = new data ^ the other data chunks. */
+        st->degraded_segments++;
+        memcpy(par, data, len);
+        for (unsigned k = 0; k < a->n - 1; k++) {
+            unsigned m = data_member(a, stripe, k);
+            if (k == d)
+                continue;
+            if (member_read(a, m, old, len, off) < 0)
+                return -1;
+            xor_buffers(par, old, len);
+        }
+        return member_write(a, pm, par, len, off);
+    }
+
+    /* Read-modify-write: parity ^= old ^ new. */
+    st->rmw_segments++;
+    if (member_read(a, dm, old, len, off) < 0 || member_read(a, pm, par, len, off) < 0)
+        return -1;
+    xor_buffers(par, old, len);
+    xor_buffers(par, data, len);
+    if (member_write(a, dm, data, len, off) < 0)
+        return -1;
+    return member_write(a, pm, par, len, off);
+}
+
+static int read_segment(struct array *a, struct stats *st, uint64_t stripe, unsigned d,
+                        uint8_t *data, size_t len, off_t off, uint8_t *tmp) {
+    unsigned dm = data_member(a, stripe, d);
+    if ((int)dm != a->failed)
+        return member_read(a, dm, data, len, off);
+    st->degraded_segments++;
+    return reconstruct(a, dm, data, tmp, len, off);
+}
+
+/* Run a read or write of [pos, pos+len) against the array, one stripe at a time. */
+static int array_rw(struct array *a, struct stats *st, int is_write, uint8_t *buf,
+                    uint64_t pos, size_t len, uint8_t *scratch) {
+    uint64_t data_per_stripe = (uint64_t)a->chunk * (a->n - 1);
+    uint8_t *old = scratch, *par = scratch + a->chunk;
+
+    while (len) {
+        uint64_t stripe = pos / data_per_stripe;
+        uint64_t in_stripe = pos % data_per_stripe;
+        size_t span = data_per_stripe - in_stripe < len ? data_per_stripe - in_stripe : len;
+        off_t moff = (off_t)(stripe * a->chunk);
+
+        pthread_mutex_t *lock = &a->stripe_locks[stripe % STRIPE_LOCKS];
+        pthread_mutex_lock(lock);
+
+        int rc = 0;
+        if (is_write && span == data_per_stripe) {
+            /* Full-stripe write: no reads needed. */
+            st->full_stripe_writes++;
+            memcpy(par, buf, a->chunk);
+            for (unsigned d = 1; d < a->n - 1; d++)
+                xor_buffers(par, buf + d * a->chunk, a->chunk);
+            for (unsigned d = 0; d < a->n - 1 && rc == 0; d++)
+                rc = member_write(a, data_member(a, stripe, d), buf + d * a->chunk, a->chunk, moff);
+            if (rc == 0)
+                rc = member_write(a, parity_member(a, stripe), par, a->chunk, moff);
+        } else {
+            size_t done = 0;
+            while (done < span && rc == 0) {
+                unsigned d = (unsigned)((in_stripe + done) / a->chunk);
+                size_t in_chunk = (in_stripe + done) % a->chunk;
+                size_t seg = a->chunk - in_chunk < span - done ? a->chunk - in_chunk : span - done;
+                if (is_write)
+                    rc = write_segment(a, st, stripe, d, buf + done, seg, moff + in_chunk, old, par);
+                else
+                    rc = read_segment(a, st, stripe, d, buf + done, seg, moff + in_chunk, old);
+                done += seg;
+            }
+        }
+
+        pthread_mutex_unlock(lock);
+        if (rc < 0)
+            return -1;
+        buf += span;
+        pos += span;
+        len -= span;
+    }
+    return 0;
+}
+
+static int array_flush(struct array *a) {
+    for (unsigned m = 0; m < a->n; m++)
+        if ((int)m != a->failed && fdatasync(a->fds[m]) < 0 && errno != EINVAL)
+            return -1;
+    return 0;
+}
+
+/* ---- transmission phase ---------------------------------------------- */
+
+static void send_reply(struct conn *c, const struct request *r, uint32_t error,
+                       const void *data, size_t len) {
+    struct nbd_wire_reply rep = {
+        .magic = htobe32(NBD_REPLY_MAGIC),
+        .error = htobe32(error),
+        .handle = r->handle,   /* opaque, echoed as received */
+    };
+    pthread_mutex_lock(&c->send_lock);
+    if (write_full(c->sock, &rep, sizeof(rep)) == 0 && !error && len)
+        write_full(c->sock, data, len);
+    pthread_mutex_unlock(&c->send_lock);
+}
+
+static void complete(struct conn *c, struct request *r, uint32_t error,
+                     const void *data, size_t len) {
+    send_reply(c, r, error, data, len);
+
+    uint64_t lat = now_ns() - r->t_recv;
+    pthread_mutex_lock(&c->stats_lock);
+    c->stats.latency_ns += lat;
+    if (error)
+        c->stats.errors++;
+    pthread_mutex_unlock(&c->stats_lock);
+
+    if (r->buf)
+        buf_put(r->buf);
+    free(r);
+
+    pthread_mutex_lock(&c->qlock);
+    if (--c->in_flight == 0)
+        pthread_cond_broadcast(&c->idle);
+    pthread_mutex_unlock(&c->qlock);
+}
+
+/*
+ * Pop the queue head and pull in queued requests of the same type that
+ * extend it contiguously in either direction. Called with qlock held.
+ * Returns the number of requests placed in `batch`, sorted by offset.
+ */
+static unsigned take_merged(struct conn *c, struct request **batch) {
+    struct request *first = c->head;
+    c->head = first->next;
+    if (!c->head)
+        c->tail = NULL;
+    first->next = NULL;
+    batch[0] = first;
+    unsigned n = 1;
+
+    if (first->type != NBD_CMD_READ && first->type != NBD_CMD_WRITE)
+        return n;
+
+    uint64_t lo = first->offset, hi = first->offset + first->len;
+    int grew = 1;
+    while (grew && n < MAX_MERGE) {
+        grew = 0;
+        struct request **pp = &c->head, *prev = NULL;
+        while (*pp && n < MAX_MERGE) {
+            struct request *r = *pp;
+            int fits = r->type == first->type && hi - lo + r->len <= MAX_REQ;
+            if (fits && (r->offset == hi || r->offset + r->len == lo)) {
+                *pp = r->next;
+                if (c->tail == r)
+                    c->tail = prev;
+                r->next = NULL;
+                if (r->offset == hi) {
+                    batch[n++] = r;
+                    hi += r->len;
+                } else {
+                    memmove(batch + 1, batch, n * sizeof(*batch));
+                    batch[0] = r;
+                    n++;
+                    lo = r->offset;
+                }
+                grew = 1;
+                continue;
+            }
+            prev = r;
+            pp = &r->next;
+        }
+    }
+    return n;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct conn *c = w->conn;
+    struct array *a = c->array;
+    struct request *batch[MAX_MERGE];
+
+    for (;;) {
+        pthread_mutex_lock(&c->qlock);
+        while (!c->head && !c->closing)
+            pthread_cond_wait(&c->qcond, &c->qlock);
+        if (!c->head) {
+            pthread_mutex_unlock(&c->qlock);
+            return NULL;
+        }
+        unsigned n = take_merged(c, batch);
+        pthread_mutex_unlock(&c->qlock);
+
+        struct request *r0 = batch[0];
+        struct stats st = {0};
+
+        if (r0->type == NBD_CMD_FLUSH) {
+            st.flushes++;
+            complete(c, r0, array_flush(a) < 0 ? EIO : 0, NULL, 0);
+        } else {
+            /* Merged requests share one buffer when one is free; else run them one by one. */
+            uint64_t lo = r0->offset;
+            size_t total = 0;
+            for (unsigned i = 0; i < n; i++)
+                total += batch[i]->len;
+            struct pool_buf *merged = n > 1 ? buf_tryget(c->pool) : NULL;
+            int is_write = r0->type == NBD_CMD_WRITE;
+
+            if (merged) {
+                st.merged += n - 1;
+                if (is_write) {
+                    size_t at = 0;
+                    for (unsigned i = 0; i < n; i++) {
+                        memcpy(merged->data + at, batch[i]->buf->data, batch[i]->len);
+                        at += batch[i]->len;
+                    }
+                }
+                int rc = array_rw(a, &st, is_write, merged->data, lo, total, w->scratch->data);
+                size_t at = 0;
+                for (unsigned i = 0; i < n; i++) {
+                    size_t len = batch[i]->len;
+                    complete(c, batch[i], rc < 0 ? EIO : 0,
+                             is_write ? NULL : merged->data + at, is_write ? 0 : len);
+                    at += len;
+                }
+                buf_put(merged);
+            } else {
+                for (unsigned i = 0; i < n; i++) {
+                    struct request *r = batch[i];
+                    int rc = array_rw(a, &st, is_write, r->buf->data, r->offset, r->len,
+                                      w->scratch->data);
+                    complete(c, r, rc < 0 ? EIO : 0,
+                             is_write ? NULL : r->buf->data, is_write ? 0 : r->len);
+                }
+            }
+            if (is_write) {
+                st.writes += n;
+                st.bytes_written += total;
+            } else {
+                st.reads += n;
+                st.bytes_read += total;
+            }
+        }
+
+        pthread_mutex_lock(&c->stats_lock);
+        c->stats.reads += st.reads;
+        c->stats.writes += st.writes;
+        c->stats.flushes += st.flushes;
+        c->stats.merged += st.merged;
+        c->stats.bytes_read += st.bytes_read;
+        c->stats.bytes_written += st.bytes_written;
+        c->stats.full_stripe_writes += st.full_stripe_writes;
+        c->stats.rmw_segments += st.rmw_segments;
+        c->stats.degraded_segments += st.degraded_segments;
+        pthread_mutex_unlock(&c->stats_lock);
+    }
+}
+
+static void enqueue(struct conn *c, struct request *r) {
+    pthread_mutex_lock(&c->qlock);
+    c->in_flight++;
+    if (c->tail)
+        c->tail->next = r;
+    else
+        c->head = r;
+    c->tail = r;
+    pthread_cond_signal(&c->qcond);
+    pthread_mutex_unlock(&c->qlock);
+}
+
+/* Drain a write payload we are not going to use. */
+static int discard(int sock, uint32_t len) {
+    uint8_t sink[4096];
+    while (len) {
+        uint32_t n = len < sizeof(sink) ? len : sizeof(sink);
+        if (read_full(sock, sink, n) < 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Reader loop: returns on NBD_CMD_DISC, EOF or a protocol error. */
+static void transmission(struct conn *c) {
+    struct array *a = c->array;
+    struct nbd_wire_request wr;
+
+    while (!stop && read_full(c->sock, &wr, sizeof(wr)) == 0) {
+        if (be32toh(wr.magic) != NBD_REQUEST_MAGIC) {
+            fprintf(stderr, "Bad request magic, dropping connection\n");
+            break;
+        }
+        struct request *r = calloc(1, sizeof(*r));
+        if (!r)
+            break;
+        r->type = be16toh(wr.type);
+        r->handle = wr.handle;
+        r->offset = be64toh(wr.offset);
+        r->len = be32toh(wr.length);
+        r->t_recv = now_ns();
+
+        if (r->type == NBD_CMD_DISC) {
+            free(r);
+            break;
+        }
+
+        uint32_t error = 0;
+        if (r->type == NBD_CMD_READ || r->type == NBD_CMD_WRITE) {
+            if (r->len > MAX_REQ)
+                error = EINVAL;
+            else if (r->offset > a->size || r->len > a->size - r->offset)
+                error = r->type == NBD_CMD_WRITE ? ENOSPC : EINVAL;
+        } else if (r->type != NBD_CMD_FLUSH) {
+            error = EINVAL;
+        }
+
+        if (error) {
+            if (r->type == NBD_CMD_WRITE && discard(c->sock, r->len) < 0) {
+                free(r);
+                break;
+            }
+            pthread_mutex_lock(&c->qlock);
+            c->in_flight++;
+            pthread_mutex_unlock(&c->qlock);
+            complete(c, r, error, NULL, 0);
+            continue;
+        }
+
+        if (r->type != NBD_CMD_FLUSH) {
+            /* Blocks when QUEUE_DEPTH requests are in flight: natural backpressure. */
+            r->buf = buf_get(c->pool);
+            if (r->type == NBD_CMD_WRITE && read_full(c->sock, r->buf->data, r->len) < 0) {
+                buf_put(r->buf);
+                free(r);
+                break;
+            }
+        }
+        enqueue(c, r);
+    }
+}
+
+/* ---- handshake ------------------------------------------------------- */
+
+static int send_opt_reply(int sock, uint32_t opt, uint32_t type, const void *data, uint32_t len) {
+    struct {
+        uint64_t magic;
+        uint32_t opt, type, len;
+    } __attribute__((packed)) hdr = {
+        htobe64(NBD_REP_MAGIC), htobe32(opt), htobe32(type), htobe32(len),
+    };
+    if (write_full(sock, &hdr, sizeof(hdr)) < 0)
+        return -1;
+    return len ? write_full(sock, data, len) : 0;
+}
+
+static int send_info(int sock, uint32_t opt, const struct array *a, uint16_t tflags, int block_size) {
+    uint8_t info[14];
+    uint16_t type = htobe16(NBD_INFO_EXPORT);
+    uint64_t size = htobe64(a->size);
+    uint16_t flags = htobe16(tflags);
+    memcpy(info, &type, 2);
+    memcpy(info + 2, &size, 8);
+    memcpy(info + 10, &flags, 2);
+    if (send_opt_reply(sock, opt, NBD_REP_INFO, info, 12) < 0)
+        return -1;
+    if (!block_size)
+        return 0;
+
+    uint32_t sizes[3] = { htobe32(512), htobe32((uint32_t)a->chunk), htobe32(MAX_REQ) };
+    type = htobe16(NBD_INFO_BLOCK_SIZE);
+    memcpy(info, &type, 2);
+    memcpy(info + 2, sizes, sizeof(sizes));
+    return send_opt_reply(sock, opt, NBD_REP_INFO, info, 14);
+}
+
+/* Returns 0 when the client entered transmission, -1 otherwise. */
+static int handshake(int sock, const struct array *a) {
+    const uint16_t tflags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH;
+    struct {
+        uint64_t init, opts;
+        uint16_t flags;
+    } __attribute__((packed)) hello = {
+        htobe64(NBD_INIT_MAGIC), htobe64(NBD_OPTS_MAGIC),
+        htobe16(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES),
+    };
+    if (write_full(sock, &hello, sizeof(hello)) < 0)
+        return -1;
+
+    uint32_t cflags;
+    if (read_full(sock, &cflags, sizeof(cflags)) < 0)
+        return -1;
+    int no_zeroes = be32toh(cflags) & NBD_FLAG_C_NO_ZEROES;
+
+    for (;;) {
+        struct {
+            uint64_t magic;
+            uint32_t opt, len;
+        } __attribute__((packed)) oh;
+        if (read_full(sock, &oh, sizeof(oh)) < 0 || be64toh(oh.magic) != NBD_OPTS_MAGIC)
+            return -1;
+        uint32_t opt = be32toh(oh.opt), len = be32toh(oh.len);
+        if (len > 4096)
+            return -1;
+        uint8_t data[4096];
+        if (len && read_full(sock, data, len) < 0)
+            return -1;
+
+        switch (opt) {
+        case NBD_OPT_EXPORT_NAME: {
+            uint8_t reply[10 + 124] = {0};
+            uint64_t size = htobe64(a->size);
+            uint16_t flags = htobe16(tflags);
+            memcpy(reply, &size, 8);
+            memcpy(reply + 8, &flags, 2);
+            return write_full(sock, reply, no_zeroes ? 10 : sizeof(reply));
+        }
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO: {
+            /* name length, name, request count, requested info types */
+            uint32_t name_len;
+            uint16_t nreq;
+            if (len < 6 || (memcpy(&name_len, data, 4), be32toh(name_len) > len - 6)) {
+                send_opt_reply(sock, opt, NBD_REP_ERR_INVALID, NULL, 0);
+                continue;
+            }
+            name_len = be32toh(name_len);
+            memcpy(&nreq, data + 4 + name_len, 2);
+            nreq = be16toh(nreq);
+            int want_block_size = 0;
+            for (uint16_t i = 0; i < nreq && 6 + name_len + 2 * (i + 1u) <= len; i++) {
+                uint16_t t;
+                memcpy(&t, data + 6 + name_len + 2 * i, 2);
+                want_block_size |= be16toh(t) == NBD_INFO_BLOCK_SIZE;
+            }
+            if (send_info(sock, opt, a, tflags, want_block_size) < 0 ||
+                send_opt_reply(sock, opt, NBD_REP_ACK, NULL, 0) < 0)
+                return -1;
+            if (opt == NBD_OPT_GO)
+                return 0;
+            continue;
+        }
+        case NBD_OPT_ABORT:
+            send_opt_reply(sock, opt, NBD_REP_ACK, NULL, 0);
+            return -1;
+        default:
+            if (send_opt_reply(sock, opt, NBD_REP_ERR_UNSUP, NULL, 0) < 0)
+                return -1;
+        }
+    }
+}
+
+/* ---- main -------------------------------------------------------------- */
+
+static void print_stats(const struct conn *c, const struct buf_pool_stats *p0, double elapsed) {
+    const struct stats *s = &c->stats;
+    uint64_t reqs = s->reads + s->writes + s->flushes;
+    printf("Session: %.3f s, %llu reads (%.2f MiB), %llu writes (%.2f MiB), %llu flushes, "
+           "%llu errors => %.0f IOPS, mean latency %.1f us\n",
+           elapsed, (unsigned long long)s->reads, (double)s->bytes_read / (1024.0 * 1024.0),
+           (unsigned long long)s->writes, (double)s->bytes_written / (1024.0 * 1024.0),
+           (unsigned long long)s->flushes, (unsigned long long)s->errors,
+           elapsed > 0 ? reqs / elapsed : 0.0,
+           reqs ? (double)s->latency_ns / reqs / 1e3 : 0.0);
+    printf("  %llu requests merged, %llu full-stripe writes, %llu RMW segments, "
+           "%llu degraded segments\n",
+           (unsigned long long)s->merged, (unsigned long long)s->full_stripe_writes,
+           (unsigned long long)s->rmw_segments, (unsigned long long)s->degraded_segments);
+
+    /* Counters are per session; the pool and its peak outlive connections. */
+    struct buf_pool_stats p;
+    buf_pool_get_stats(c->pool, &p);
+    printf("  buffer pool: %llu gets, %llu stalls (%.3f ms); peak %u/%u in use since start\n",
+           (unsigned long long)(p.gets - p0->gets), (unsigned long long)(p.stalls - p0->stalls),
+           (double)(p.stall_ns - p0->stall_ns) / 1e6, p.peak_in_use, p.nbufs);
+}
+
+static void serve(int sock, struct array *a, struct buf_pool *pool, unsigned nworkers) {
+    struct conn c = { .sock = sock, .array = a, .pool = pool };
+    struct buf_pool_stats pool_start;
+    buf_pool_get_stats(pool, &pool_start);
+    pthread_mutex_init(&c.qlock, NULL);
+    pthread_cond_init(&c.qcond, NULL);
+    pthread_cond_init(&c.idle, NULL);
+    pthread_mutex_init(&c.send_lock, NULL);
+    pthread_mutex_init(&c.stats_lock, NULL);
+
+    struct worker workers[MAX_WORKERS];
+    for (unsigned i = 0; i < nworkers; i++) {
+        workers[i].conn = &c;
+        workers[i].scratch = buf_get(pool);
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+    uint64_t t0 = now_ns();
+    transmission(&c);
+
+    pthread_mutex_lock(&c.qlock);
+    while (c.in_flight)
+        pthread_cond_wait(&c.idle, &c.qlock);
+    c.closing = 1;
+    pthread_cond_broadcast(&c.qcond);
+    pthread_mutex_unlock(&c.qlock);
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        buf_put(workers[i].scratch);
+    }
+    array_flush(a);
+    print_stats(&c, &pool_start, (now_ns() - t0) / 1e9);
+
+    pthread_mutex_destroy(&c.stats_lock);
+    pthread_mutex_destroy(&c.send_lock);
+    pthread_cond_destroy(&c.idle);
+    pthread_cond_destroy(&c.qcond);
+    pthread_mutex_destroy(&c.qlock);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-s socket] [-c chunk_kib] [-j workers] [-f failed_member] "
+            "<member0> <member1> <member2> ...\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *sock_path = DEFAULT_SOCKET;
+    size_t chunk = DEFAULT_CHUNK;
+    unsigned nworkers = 4;
+    int failed = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:j:f:")) != -1) {
+        switch (opt) {
+        case 's': sock_path = optarg; break;
+        case 'c': chunk = strtoul(optarg, NULL, 10) * 1024; break;
+        case 'j': nworkers = strtoul(optarg, NULL, 10); break;
+        case 'f': {
+            char *end;
+            errno = 0;
+            long v = strtol(optarg, &end, 10);
+            if (end == optarg || *end || errno || v < 0 || v >= MAX_MEMBERS) {
+                fprintf(stderr, "Invalid failed member '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            failed = (int)v;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned n = argc - optind;
+    if (n < 3 || n > MAX_MEMBERS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (chunk < 4096 || chunk % 4096 || 2 * chunk > MAX_REQ || nworkers < 1 ||
+        nworkers > MAX_WORKERS || failed >= (int)n) {
+        fprintf(stderr, "Invalid chunk size, worker count or failed member\n");
+        return EXIT_FAILURE;
+    }
+
+    struct array a = { .n = n, .failed = failed, .chunk = chunk };
+    off_t member_size = -1;
+    for (unsigned m = 0; m < n; m++) {
+        if ((int)m == failed) {
+            a.fds[m] = -1;
+            continue;
+        }
+        a.fds[m] = open(argv[optind + m], O_RDWR);
+        if (a.fds[m] < 0) {
+            perror(argv[optind + m]);
+            return EXIT_FAILURE;
+        }
+        off_t sz = lseek(a.fds[m], 0, SEEK_END);
+        if (sz < 0) {
+            perror(argv[optind + m]);
+            return EXIT_FAILURE;
+        }
+        if (member_size < 0 || sz < member_size)
+            member_size = sz;
+    }
+    a.stripes = (uint64_t)member_size / chunk;
+    a.size = a.stripes * chunk * (n - 1);
+    if (a.size == 0) {
+        fprintf(stderr, "Members are smaller than one chunk\n");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < STRIPE_LOCKS; i++)
+        pthread_mutex_init(&a.stripe_locks[i], NULL);
+
+    /* Queue slots, one scratch buffer per worker, and merge buffers. */
+    struct buf_pool *pool = buf_pool_create(MAX_REQ, QUEUE_DEPTH + 2 * nworkers, BUF_POOL_DEFAULT);
+    if (!pool) {
+        perror("Allocating buffer pool");
+        return EXIT_FAILURE;
+    }
+
+    int lsock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (lsock < 0 || strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Cannot create socket %s\n", sock_path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, sock_path);
+    unlink(sock_path);
+    if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lsock, 4) < 0) {
+        perror("bind/listen");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Serving %u-member RAID-5 (%zu KiB chunks%s), %.2f GiB on %s\n", n, chunk / 1024,
+           failed >= 0 ? ", degraded" : "", (double)a.size / (1024.0 * 1024.0 * 1024.0), sock_path);
+    fflush(stdout);
+
+    while (!stop) {
+        int sock = accept(lsock, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        if (handshake(sock, &a) == 0)
+            serve(sock, &a, pool, nworkers);
+        close(sock);
+        fflush(stdout);
+    }
+
+    close(lsock);
+    unlink(sock_path);
+    buf_pool_destroy(pool);
+    for (unsigned m = 0; m < n; m++)
+        if (a.fds[m] >= 0)
+            close(a.fds[m]);
+    return EXIT_SUCCESS;
+}
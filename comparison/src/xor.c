@@ -8,24 +8,37 @@
 #include <time.h>
 #include <stdint.h>
 
+#include "buf_pool.h"
+#include "io_sched.h"
+#include "xor_engine.h"
+
 #define BLOCK_SIZE    (4 * 1024 * 1024)
-#define ALIGNMENT     4096
 
-static inline void xor_buffers(uint8_t *dst, const uint8_t *src, size_t n) {
-    for (size_t i = 0; i < n; i++) {
-        dst[i] ^= src[i];
-    }
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-r MiB/s] [-l target_us] <input1> <input2> <output>\n"
+            IO_SCHED_USAGE, prog);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <input1> <input2> <output>\n", argv[0]);
+    struct io_sched_config qos;
+    io_sched_config_init(&qos);
+
+    int opt;
+    while ((opt = getopt(argc, argv, IO_SCHED_OPTS)) != -1) {
+        if (io_sched_parse_opt(&qos, opt, optarg) <= 0) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    const char *in1_path = argv[1];
-    const char *in2_path = argv[2];
-    const char *out_path = argv[3];
+    const char *in1_path = argv[optind];
+    const char *in2_path = argv[optind + 1];
+    const char *out_path = argv[optind + 2];
 
     int fd1 = open(in1_path, O_RDONLY | O_DIRECT);
     if (fd1 < 0) {
@@ -46,14 +59,29 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    uint8_t *buf1, *buf2;
-    if (posix_memalign((void **)&buf1, ALIGNMENT, BLOCK_SIZE) != 0 ||
-        posix_memalign((void **)&buf2, ALIGNMENT, BLOCK_SIZE) != 0) {
-        fprintf(stderr, "posix_memalign failed\n");
+    struct buf_pool *pool = buf_pool_create(BLOCK_SIZE, 3, BUF_POOL_DEFAULT);
+    if (!pool) {
+        perror("buf_pool_create");
         close(fd1); close(fd2); close(fd3);
         return EXIT_FAILURE;
     }
 
+    struct io_sched *sched = io_sched_create(&qos);
+    if (!sched) {
+        perror("io_sched_create");
+        buf_pool_destroy(pool);
+        close(fd1); close(fd2); close(fd3);
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * There is no real foreground traffic to measure here, so in adaptive
+     * mode small random reads on the first input stand in for it.
+     */
+    struct pool_buf *probe_buf = qos.adaptive ? buf_get(pool) : NULL;
+    off_t dev_size = lseek(fd1, 0, SEEK_END);
+    lseek(fd1, 0, SEEK_SET);
+
     struct timespec t_start, t_end;
     off_t total_bytes = 0;
 
@@ -63,27 +91,40 @@ int main(int argc, char *argv[]) {
     }
 
     while (1) {
-        ssize_t r1 = read(fd1, buf1, BLOCK_SIZE);
-        if (r1 < 0) {
-            perror("read input1");
-            break;
-        }
-        if (r1 == 0) {
+        /* Read stage: fill two pool buffers. */
+        struct pool_buf *buf1 = buf_get(pool);
+        struct pool_buf *buf2 = buf_get(pool);
+
+        if (probe_buf)
+            io_sched_probe(sched, fd1, probe_buf->data, dev_size);
+
+        ssize_t r1 = io_sched_read(sched, IO_CLASS_BG, fd1, buf1->data, BLOCK_SIZE);
+        if (r1 <= 0) {
+            if (r1 < 0)
+                perror("read input1");
+            buf_put(buf1); buf_put(buf2);
             break;
         }
+        buf1->len = r1;
 
-        ssize_t r2 = read(fd2, buf2, r1);
+        ssize_t r2 = io_sched_read(sched, IO_CLASS_BG, fd2, buf2->data, r1);
         if (r2 < 0) {
             perror("read input2");
+            buf_put(buf1); buf_put(buf2);
             break;
         }
         if (r2 != r1) {
             fprintf(stderr, "Warning: mismatched block sizes (%zd vs %zd)\n", r1, r2);
         }
+        buf2->len = r2;
 
-        xor_buffers(buf1, buf2, r1);
+        /* Compute stage: fold buf2 into buf1 and release it. */
+        xor_buffers(buf1->data, buf2->data, buf1->len);
+        buf_put(buf2);
 
-        ssize_t w = write(fd3, buf1, r1);
+        /* Write stage: owns buf1 until the write completes. */
+        ssize_t w = io_sched_write(sched, IO_CLASS_BG, fd3, buf1->data, buf1->len);
+        buf_put(buf1);
         if (w < 0) {
             perror("write output");
             break;
@@ -104,8 +145,12 @@ int main(int argc, char *argv[]) {
         printf("Processed %.2f GiB in %.3f s => %.2f GiB/s\n", gib, elapsed, gib / elapsed);
     }
 
-    free(buf1);
-    free(buf2);
+    if (probe_buf)
+        buf_put(probe_buf);
+    io_sched_print_stats(sched, stdout);
+    io_sched_destroy(sched);
+    buf_pool_print_stats(pool, stdout);
+    buf_pool_destroy(pool);
     close(fd1);
     close(fd2);
     close(fd3);
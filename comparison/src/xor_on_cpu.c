@@ -6,6 +6,9 @@
 #include <errno.h>
 #include <time.h>
 
+#include "buf_pool.h"
+#include "io_sched.h"
+
 #define BLOCK_SIZE (100 * 1024 * 1024)  // 100 MB
 #define disk1 "/dev/nvme0n1p12"
 #define disk2 "/dev/nvme0n1p13"
@@ -16,7 +19,18 @@ double get_duration_sec(struct timespec start, struct timespec end) {
            (end.tv_nsec - start.tv_nsec) / 1e9;
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    struct io_sched_config qos;
+    io_sched_config_init(&qos);
+
+    int opt;
+    while ((opt = getopt(argc, argv, IO_SCHED_OPTS)) != -1) {
+        if (io_sched_parse_opt(&qos, opt, optarg) <= 0) {
+            fprintf(stderr, "Usage: %s [-r MiB/s] [-l target_us]\n" IO_SCHED_USAGE, argv[0]);
+            return 1;
+        }
+    }
+
     struct timespec start_time, end_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
 
@@ -34,23 +48,38 @@ int main(void) {
         return 1;
     }
 
-    unsigned char *buf1 = (unsigned char *) malloc(BLOCK_SIZE);
-    unsigned char *buf2 = (unsigned char *) malloc(BLOCK_SIZE);
-    unsigned char *buf3 = (unsigned char *) malloc(BLOCK_SIZE);
+    struct buf_pool *pool = buf_pool_create(BLOCK_SIZE, qos.adaptive ? 4 : 3, BUF_POOL_DEFAULT);
+    if (!pool) {
+        perror("buf_pool_create");
+        close(fd1); close(fd2); close(fd3);
+        return 1;
+    }
+    struct pool_buf *pb1 = buf_get(pool), *pb2 = buf_get(pool), *pb3 = buf_get(pool);
 
-    if (!buf1 || !buf2 || !buf3) {
-        fprintf(stderr, "Memory allocation failed\n");
+    struct io_sched *sched = io_sched_create(&qos);
+    if (!sched) {
+        perror("io_sched_create");
+        buf_pool_destroy(pool);
         close(fd1); close(fd2); close(fd3);
-        free(buf1); free(buf2); free(buf3);
         return 1;
     }
+    // In adaptive mode, probe reads on disk1 stand in for foreground traffic.
+    struct pool_buf *probe_buf = qos.adaptive ? buf_get(pool) : NULL;
+    off_t dev_size = lseek(fd1, 0, SEEK_END);
+    lseek(fd1, 0, SEEK_SET);
+
+    unsigned char *buf1 = pb1->data;
+    unsigned char *buf2 = pb2->data;
+    unsigned char *buf3 = pb3->data;
 
     ssize_t bytes1, bytes2;
     size_t total_xored = 0;
 
     while (1) {
-        bytes1 = read(fd1, buf1, BLOCK_SIZE);
-        bytes2 = read(fd2, buf2, BLOCK_SIZE);
+        if (probe_buf)
+            io_sched_probe(sched, fd1, probe_buf->data, dev_size);
+        bytes1 = io_sched_read(sched, IO_CLASS_BG, fd1, buf1, BLOCK_SIZE);
+        bytes2 = io_sched_read(sched, IO_CLASS_BG, fd2, buf2, BLOCK_SIZE);
 
         if (bytes1 < 0 || bytes2 < 0) {
             perror("Read error");
@@ -70,7 +99,7 @@ int main(void) {
             buf3[i] = buf1[i] ^ buf2[i];
         }
 
-        ssize_t written = write(fd3, buf3, bytes1);
+        ssize_t written = io_sched_write(sched, IO_CLASS_BG, fd3, buf3, bytes1);
         if (written != bytes1) {
             perror("Write error");
             break;
@@ -80,7 +109,12 @@ int main(void) {
     }
 
     close(fd1); close(fd2); close(fd3);
-    free(buf1); free(buf2); free(buf3);
+    buf_put(pb1); buf_put(pb2); buf_put(pb3);
+    if (probe_buf) buf_put(probe_buf);
+    io_sched_print_stats(sched, stdout);
+    io_sched_destroy(sched);
+    buf_pool_print_stats(pool, stdout);
+    buf_pool_destroy(pool);
 
     clock_gettime(CLOCK_MONOTONIC, &end_time);
     double duration = get_duration_sec(start_time, end_time);
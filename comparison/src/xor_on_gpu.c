@@ -9,6 +9,10 @@
 #include <errno.h>
 #include <time.h>
 
+#include "buf_pool.h"
+#include "buf_pool_cl.h"
+#include "io_sched.h"
+
 #define BLOCK_SIZE (100 * 1024 * 1024)  // 100 MB
 #define disk1 "/dev/nvme0n1p12"
 #define disk2 "/dev/nvme0n1p13"
@@ -33,7 +37,18 @@ double get_duration_sec(struct timespec start, struct timespec end) {
 }
 
 
-int main() {
+int main(int argc, char *argv[]) {
+    struct io_sched_config qos;
+    io_sched_config_init(&qos);
+
+    int opt;
+    while ((opt = getopt(argc, argv, IO_SCHED_OPTS)) != -1) {
+        if (io_sched_parse_opt(&qos, opt, optarg) <= 0) {
+            fprintf(stderr, "Usage: %s [-r MiB/s] [-l target_us]\n" IO_SCHED_USAGE, argv[0]);
+            return 1;
+        }
+    }
+
     struct timespec start_time, end_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
 
@@ -48,14 +63,25 @@ int main() {
         return 1;
     }
 
-    unsigned char *buf1 = (unsigned char *)malloc(BLOCK_SIZE);
-    unsigned char *buf2 = (unsigned char *)malloc(BLOCK_SIZE);
-    unsigned char *buf3 = (unsigned char *)malloc(BLOCK_SIZE);
+    struct buf_pool *pool = buf_pool_create(BLOCK_SIZE, qos.adaptive ? 4 : 3, BUF_POOL_DEFAULT);
+    if (!pool) {
+        perror("buf_pool_create");
+        close(fd1); close(fd2); close(fd3);
+        return 1;
+    }
+    struct pool_buf *pb1 = buf_get(pool), *pb2 = buf_get(pool), *pb3 = buf_get(pool);
 
-    if (!buf1 || !buf2 || !buf3) {
-        fprintf(stderr, "Memory allocation failed\n");
+    struct io_sched *sched = io_sched_create(&qos);
+    if (!sched) {
+        perror("io_sched_create");
+        buf_pool_destroy(pool);
+        close(fd1); close(fd2); close(fd3);
         return 1;
     }
+    // In adaptive mode, probe reads on disk1 stand in for foreground traffic.
+    struct pool_buf *probe_buf = qos.adaptive ? buf_get(pool) : NULL;
+    off_t dev_size = lseek(fd1, 0, SEEK_END);
+    lseek(fd1, 0, SEEK_SET);
 
     cl_int err;
     cl_platform_id platform;
@@ -93,16 +119,32 @@ int main() {
     kernel = clCreateKernel(program, "xor_buffers", &err);
     checkErr(err, "clCreateKernel");
 
-    cl_mem bufA = clCreateBuffer(context, CL_MEM_READ_ONLY, BLOCK_SIZE, NULL, &err);
-    cl_mem bufB = clCreateBuffer(context, CL_MEM_READ_ONLY, BLOCK_SIZE, NULL, &err);
-    cl_mem bufC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, BLOCK_SIZE, NULL, &err);
+    // Device buffers are the pool slots themselves; see buf_pool_cl.h.
+    cl_mem *slab_mem = buf_pool_cl_register(pool, context, CL_MEM_READ_WRITE, &err);
+    checkErr(err, "buf_pool_cl_register");
+    cl_mem bufA = slab_mem[pb1->index];
+    cl_mem bufB = slab_mem[pb2->index];
+    cl_mem bufC = slab_mem[pb3->index];
 
     size_t total_xored = 0;
     ssize_t bytes1, bytes2;
 
     while (1) {
-        bytes1 = read(fd1, buf1, BLOCK_SIZE);
-        bytes2 = read(fd2, buf2, BLOCK_SIZE);
+        unsigned char *buf1 = clEnqueueMapBuffer(queue, bufA, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                                 0, BLOCK_SIZE, 0, NULL, NULL, &err);
+        checkErr(err, "clEnqueueMapBuffer");
+        unsigned char *buf2 = clEnqueueMapBuffer(queue, bufB, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                                 0, BLOCK_SIZE, 0, NULL, NULL, &err);
+        checkErr(err, "clEnqueueMapBuffer");
+
+        if (probe_buf)
+            io_sched_probe(sched, fd1, probe_buf->data, dev_size);
+        bytes1 = io_sched_read(sched, IO_CLASS_BG, fd1, buf1, BLOCK_SIZE);
+        bytes2 = io_sched_read(sched, IO_CLASS_BG, fd2, buf2, BLOCK_SIZE);
+
+        err = clEnqueueUnmapMemObject(queue, bufA, buf1, 0, NULL, NULL);
+        err |= clEnqueueUnmapMemObject(queue, bufB, buf2, 0, NULL, NULL);
+        checkErr(err, "clEnqueueUnmapMemObject");
 
         if (bytes1 < 0 || bytes2 < 0) {
             perror("Read error");
@@ -117,10 +159,6 @@ int main() {
             break;
         }
 
-        err = clEnqueueWriteBuffer(queue, bufA, CL_TRUE, 0, bytes1, buf1, 0, NULL, NULL);
-        err |= clEnqueueWriteBuffer(queue, bufB, CL_TRUE, 0, bytes1, buf2, 0, NULL, NULL);
-        checkErr(err, "clEnqueueWriteBuffer");
-
         err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufA);
         err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufB);
         err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufC);
@@ -130,10 +168,13 @@ int main() {
         err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
         checkErr(err, "clEnqueueNDRangeKernel");
 
-        err = clEnqueueReadBuffer(queue, bufC, CL_TRUE, 0, bytes1, buf3, 0, NULL, NULL);
-        checkErr(err, "clEnqueueReadBuffer");
+        unsigned char *buf3 = clEnqueueMapBuffer(queue, bufC, CL_TRUE, CL_MAP_READ, 0, bytes1,
+                                                 0, NULL, NULL, &err);
+        checkErr(err, "clEnqueueMapBuffer");
 
-        ssize_t written = write(fd3, buf3, bytes1);
+        ssize_t written = io_sched_write(sched, IO_CLASS_BG, fd3, buf3, bytes1);
+        err = clEnqueueUnmapMemObject(queue, bufC, buf3, 0, NULL, NULL);
+        checkErr(err, "clEnqueueUnmapMemObject");
         if (written != bytes1) {
             perror("Write error");
             break;
@@ -142,12 +183,16 @@ int main() {
         total_xored += bytes1;
     }
 
+    clFinish(queue);
     close(fd1); close(fd2); close(fd3);
-    free(buf1); free(buf2); free(buf3);
+    buf_pool_cl_release(pool, slab_mem);
+    buf_put(pb1); buf_put(pb2); buf_put(pb3);
+    if (probe_buf) buf_put(probe_buf);
+    io_sched_print_stats(sched, stdout);
+    io_sched_destroy(sched);
+    buf_pool_print_stats(pool, stdout);
+    buf_pool_destroy(pool);
 
-    clReleaseMemObject(bufA);
-    clReleaseMemObject(bufB);
-    clReleaseMemObject(bufC);
     clReleaseKernel(kernel);
     clReleaseProgram(program);
     clReleaseCommandQueue(queue);
@@ -10,8 +10,11 @@
 #include <string.h>
 #include <errno.h>
 
+#include "buf_pool.h"
+#include "buf_pool_cl.h"
+#include "io_sched.h"
+
 #define BLOCK_SIZE   (4 * 1024 * 1024)
-#define ALIGNMENT    4096             
 #define VECTOR_WIDTH 16               
 #define LOCAL_WS     256
 
@@ -35,13 +38,21 @@ const char *kernel_src =
         "}\n";
 
 int main(int argc, char **argv) {	
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <in1> <in2> <out>\n", argv[0]);
+    struct io_sched_config qos;
+    io_sched_config_init(&qos);
+
+    int opt;
+    while ((opt = getopt(argc, argv, IO_SCHED_OPTS)) != -1) {
+        if (io_sched_parse_opt(&qos, opt, optarg) <= 0)
+            break;
+    }
+    if (opt != -1 || argc - optind != 3) {
+        fprintf(stderr, "Usage: %s [-r MiB/s] [-l target_us] <in1> <in2> <out>\n" IO_SCHED_USAGE, argv[0]);
         return EXIT_FAILURE;
     }
-    const char *in1_path = argv[1];
-    const char *in2_path = argv[2];
-    const char *out_path = argv[3];
+    const char *in1_path = argv[optind];
+    const char *in2_path = argv[optind + 1];
+    const char *out_path = argv[optind + 2];
 
     int fd1 = open(in1_path, O_RDONLY | O_DIRECT);
     if (fd1 < 0) perror_exit("open in1");
@@ -50,13 +61,16 @@ int main(int argc, char **argv) {
     int fd3 = open(out_path, O_RDWR   | O_DIRECT | O_CREAT, 0644);
     if (fd3 < 0) perror_exit("open out");
     
-    uint8_t *h_buf1, *h_buf2, *h_out;
-    if (posix_memalign((void**)&h_buf1, ALIGNMENT, BLOCK_SIZE) ||
-        posix_memalign((void**)&h_buf2, ALIGNMENT, BLOCK_SIZE) ||
-        posix_memalign((void**)&h_out,  ALIGNMENT, BLOCK_SIZE)) {
-        fprintf(stderr, "posix_memalign failed\n");
-        return EXIT_FAILURE;
-    }
+    struct buf_pool *pool = buf_pool_create(BLOCK_SIZE, 4, BUF_POOL_DEFAULT);
+    if (!pool) perror_exit("buf_pool_create");
+    struct pool_buf *pb1 = buf_get(pool), *pb2 = buf_get(pool), *pb_out = buf_get(pool);
+
+    struct io_sched *sched = io_sched_create(&qos);
+    if (!sched) perror_exit("io_sched_create");
+    // In adaptive mode, probe reads on in1 stand in for foreground traffic.
+    struct pool_buf *probe_buf = qos.adaptive ? buf_get(pool) : NULL;
+    off_t dev_size = lseek(fd1, 0, SEEK_END);
+    lseek(fd1, 0, SEEK_SET);
 
     cl_int err;
     cl_uint num_platforms = 0;
@@ -139,16 +153,14 @@ int main(int argc, char **argv) {
     cl_kernel kernel = clCreateKernel(prog, "xor_kernel", &err);
     CHECK_CL_ERR(err, "clCreateKernel");
 
-    //size_t vector_count = BLOCK_SIZE / VECTOR_WIDTH;
-    cl_mem bufA = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-                                 BLOCK_SIZE, NULL, &err);
-    CHECK_CL_ERR(err, "clCreateBuffer A");
-    cl_mem bufB = clCreateBuffer(ctx, CL_MEM_READ_ONLY,
-                                 BLOCK_SIZE, NULL, &err);
-    CHECK_CL_ERR(err, "clCreateBuffer B");
-    cl_mem bufC = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
-                                 BLOCK_SIZE, NULL, &err);
-    CHECK_CL_ERR(err, "clCreateBuffer C");
+    // The kernel works directly on the pool slots: the inputs are read from
+    // disk into the mapped slots and the output is written back from its
+    // mapped slot, so there is no separate host<->device staging copy.
+    cl_mem *slab_mem = buf_pool_cl_register(pool, ctx, CL_MEM_READ_WRITE, &err);
+    CHECK_CL_ERR(err, "buf_pool_cl_register");
+    cl_mem bufA = slab_mem[pb1->index];
+    cl_mem bufB = slab_mem[pb2->index];
+    cl_mem bufC = slab_mem[pb_out->index];
 
     CHECK_CL_ERR(clSetKernelArg(kernel, 0, sizeof(bufA), &bufA), "clSetKernelArg 0");
     CHECK_CL_ERR(clSetKernelArg(kernel, 1, sizeof(bufB), &bufB), "clSetKernelArg 1");
@@ -159,9 +171,26 @@ int main(int argc, char **argv) {
 	
     off_t total = 0;
     while (1) {
-        ssize_t r1 = read(fd1, h_buf1, BLOCK_SIZE);
-        if (r1 <= 0) break;
-        ssize_t r2 = read(fd2, h_buf2, r1);
+        uint8_t *h_buf1 = clEnqueueMapBuffer(queue, bufA, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                             0, BLOCK_SIZE, 0, NULL, NULL, &err);
+        CHECK_CL_ERR(err, "clEnqueueMapBuffer A");
+        uint8_t *h_buf2 = clEnqueueMapBuffer(queue, bufB, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                             0, BLOCK_SIZE, 0, NULL, NULL, &err);
+        CHECK_CL_ERR(err, "clEnqueueMapBuffer B");
+
+        if (probe_buf) io_sched_probe(sched, fd1, probe_buf->data, dev_size);
+        ssize_t r1 = io_sched_read(sched, IO_CLASS_BG, fd1, h_buf1, BLOCK_SIZE);
+        ssize_t r2 = r1 > 0 ? io_sched_read(sched, IO_CLASS_BG, fd2, h_buf2, r1) : 0;
+
+        cl_event evtA, evtB;
+        CHECK_CL_ERR(clEnqueueUnmapMemObject(queue, bufA, h_buf1, 0, NULL, &evtA), "clEnqueueUnmapMemObject A");
+        CHECK_CL_ERR(clEnqueueUnmapMemObject(queue, bufB, h_buf2, 0, NULL, &evtB), "clEnqueueUnmapMemObject B");
+        if (r1 <= 0) {
+            clWaitForEvents(2, (cl_event[]){evtA, evtB});
+            clReleaseEvent(evtA);
+            clReleaseEvent(evtB);
+            break;
+        }
         if (r2 < 0) { perror_exit("read in2"); }
         if (r2 != r1) {
             fprintf(stderr, "Warning: read sizes differ (%zd vs %zd)\n", r1, r2);
@@ -170,26 +199,24 @@ int main(int argc, char **argv) {
         size_t bytes = (size_t)r1;
         size_t vecs = bytes / VECTOR_WIDTH;
 
-        cl_event evtA, evtB;
-        CHECK_CL_ERR(clEnqueueWriteBuffer(queue, bufA, CL_FALSE, 0,
-                                          vecs * VECTOR_WIDTH, h_buf1,
-                                          0, NULL, &evtA),
-                     "clEnqueueWriteBuffer A");
-        CHECK_CL_ERR(clEnqueueWriteBuffer(queue, bufB, CL_FALSE, 0,
-                                          vecs * VECTOR_WIDTH, h_buf2,
-                                          0, NULL, &evtB),
-                     "clEnqueueWriteBuffer B");
-
         size_t global_ws = ((vecs + LOCAL_WS - 1) / LOCAL_WS) * LOCAL_WS;
         cl_event evtK;
         CHECK_CL_ERR(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_ws, (size_t[]){LOCAL_WS}, 2, (cl_event[]){evtA, evtB}, &evtK), "clEnqueueNDRangeKernel");
 
-        CHECK_CL_ERR(clEnqueueReadBuffer(queue, bufC, CL_TRUE, 0, vecs * VECTOR_WIDTH, h_out, 1, &evtK, NULL), "clEnqueueReadBuffer C");
+        uint8_t *h_out = clEnqueueMapBuffer(queue, bufC, CL_TRUE, CL_MAP_READ, 0, bytes,
+                                            1, &evtK, NULL, &err);
+        CHECK_CL_ERR(err, "clEnqueueMapBuffer C");
 
-        ssize_t w = write(fd3, h_out, bytes);
+        ssize_t w = io_sched_write(sched, IO_CLASS_BG, fd3, h_out, bytes);
         if (w < 0) perror_exit("write out");
         total += w;
+
+        CHECK_CL_ERR(clEnqueueUnmapMemObject(queue, bufC, h_out, 0, NULL, NULL), "clEnqueueUnmapMemObject C");
+        clReleaseEvent(evtA);
+        clReleaseEvent(evtB);
+        clReleaseEvent(evtK);
     }
+    clFinish(queue);
 
     clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
     double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
@@ -199,16 +226,19 @@ int main(int argc, char **argv) {
     close(fd1);
     close(fd2);
     close(fd3);
-    free(h_buf1);
-    free(h_buf2);
-    free(h_out);
-    clReleaseMemObject(bufA);
-    clReleaseMemObject(bufB);
-    clReleaseMemObject(bufC);
+    buf_put(pb1);
+    buf_put(pb2);
+    buf_put(pb_out);
+    if (probe_buf) buf_put(probe_buf);
+    io_sched_print_stats(sched, stdout);
+    io_sched_destroy(sched);
+    buf_pool_print_stats(pool, stdout);
+    buf_pool_cl_release(pool, slab_mem);
     clReleaseKernel(kernel);
     clReleaseProgram(prog);
     clReleaseCommandQueue(queue);
     clReleaseContext(ctx);
+    buf_pool_destroy(pool);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,126 @@
+#include "parity_engine.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <iostream>
+#include <random>
+
+using namespace std;
+using namespace gpuraid;
+
+// Keeps `jobs` XOR operations of `members` x `size` bytes in flight on one
+// submitting thread, then checks every parity block against a serial XOR.
+
+struct Stripe {
+    vector<vector<uint8_t>> members;
+    vector<uint8_t> parity;
+
+    XorJob job(Backend backend = Backend::Auto) {
+        XorJob j;
+        for (auto &m : members)
+            j.sources.push_back(m.data());
+        j.dest = parity.data();
+        j.length = parity.size();
+        j.backend = backend;
+        return j;
+    }
+
+    bool check() const {
+        for (size_t i = 0; i < parity.size(); ++i) {
+            uint8_t x = 0;
+            for (auto &m : members)
+                x ^= m[i];
+            if (x != parity[i])
+                return false;
+        }
+        return true;
+    }
+};
+
+// Minimal fire-and-forget coroutine so the awaitable can be driven from main.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+Detached rebuild(ParityEngine &engine, Stripe &stripe, promise<bool> &done) {
+    co_await engine.async_xor(stripe.job());
+    done.set_value(stripe.check());
+}
+
+int main(int argc, char **argv) {
+    size_t jobs = argc > 1 ? stoul(argv[1]) : 512;
+    size_t members = argc > 2 ? stoul(argv[2]) : 4;
+    size_t size = argc > 3 ? stoul(argv[3]) : 1 << 20;
+
+    mt19937 rng(42);
+    // One extra stripe for the coroutine job so it never races the others.
+    vector<Stripe> stripes(jobs + 1);
+    for (auto &s : stripes) {
+        s.members.assign(members, vector<uint8_t>(size));
+        for (auto &m : s.members)
+            for (auto &b : m)
+                b = (uint8_t)rng();
+        s.parity.resize(size);
+    }
+    Stripe &co_stripe = stripes.back();
+
+    try {
+        EngineStats st;
+        chrono::duration<double> elapsed;
+        size_t bad = 0;
+        atomic<size_t> callbacks{0};
+        bool co_ok;
+        {
+            ParityEngine engine;
+            cerr << (engine.has_opencl() ? "OpenCL + CPU" : "CPU only") << endl;
+
+            auto start = chrono::high_resolution_clock::now();
+            vector<future<void>> futures;
+            for (size_t i = 0; i < jobs; ++i)
+                futures.push_back(engine.submit(stripes[i].job()));
+            for (auto &f : futures)
+                f.get();
+            elapsed = chrono::high_resolution_clock::now() - start;
+
+            for (size_t i = 0; i < jobs; ++i)
+                bad += !stripes[i].check();
+
+            for (size_t i = 0; i < jobs; ++i)
+                engine.submit(stripes[i].job(Backend::Cpu), [&callbacks](exception_ptr e) {
+                    if (!e)
+                        callbacks++;
+                });
+
+            promise<bool> co_done;
+            auto co_result = co_done.get_future();
+            rebuild(engine, co_stripe, co_done);
+            co_ok = co_result.get();
+
+            st = engine.stats();
+            // The engine destructor waits for the callback jobs.
+        }
+
+        double gib = (double)jobs * members * size / (1024.0 * 1024.0 * 1024.0);
+        cerr << jobs << " JOBS IN " << elapsed.count() << " SECONDS (" << gib / elapsed.count() << " GiB/s IN)" << endl;
+        cerr << st.cpu_jobs << " CPU, " << st.gpu_jobs << " GPU IN " << st.gpu_batches << " BATCHES ("
+             << st.gpu_fallbacks << " RERUN ON CPU), PEAK " << st.peak_in_flight << " IN FLIGHT" << endl;
+
+        if (bad || callbacks != jobs || !co_ok) {
+            cerr << "ERROR: " << bad << " BAD PARITY BLOCKS, " << callbacks << "/" << jobs << " CALLBACKS, COROUTINE "
+                 << (co_ok ? "OK" : "FAILED") << endl;
+            return 1;
+        }
+        cerr << "NO ERRORS FOUND" << endl;
+    } catch (const exception &ex) {
+        cerr << "Error: " << ex.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,322 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+#include <CL/opencl.hpp>
+
+#include "parity_engine.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace gpuraid {
+
+namespace {
+
+constexpr size_t VECTOR_WIDTH = 16;
+
+const char *kernel_source = R"(
+__kernel void xor_accumulate(__global uchar16 *acc, __global const uchar16 *src) {
+    size_t gid = get_global_id(0);
+    acc[gid] ^= src[gid];
+}
+)";
+
+// XOR bytes [begin, end) of every source into dest, one word at a time so a
+// dest that aliases a source is read before it is overwritten.
+void xor_range(const XorJob &job, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + sizeof(uint64_t) <= end; i += sizeof(uint64_t)) {
+        uint64_t acc, word;
+        memcpy(&acc, job.sources[0] + i, sizeof(acc));
+        for (size_t k = 1; k < job.sources.size(); ++k) {
+            memcpy(&word, job.sources[k] + i, sizeof(word));
+            acc ^= word;
+        }
+        memcpy(job.dest + i, &acc, sizeof(acc));
+    }
+    for (; i < end; ++i) {
+        uint8_t acc = job.sources[0][i];
+        for (size_t k = 1; k < job.sources.size(); ++k)
+            acc ^= job.sources[k][i];
+        job.dest[i] = acc;
+    }
+}
+
+} // namespace
+
+class OpenClBackend {
+public:
+    OpenClBackend() {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        for (auto &platform : platforms) {
+            std::vector<cl::Device> devices;
+            try {
+                platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+            } catch (const cl::Error &) {
+                continue;  // CL_DEVICE_NOT_FOUND on CPU-only platforms
+            }
+            if (!devices.empty()) {
+                device_ = devices[0];
+                break;
+            }
+        }
+        if (!device_())
+            throw std::runtime_error("no OpenCL GPU device found");
+
+        context_ = cl::Context(device_);
+        queue_ = cl::CommandQueue(context_, device_);
+        cl::Program program(context_, kernel_source);
+        program.build({device_});
+        kernel_ = cl::Kernel(program, "xor_accumulate");
+    }
+
+    // Runs a batch on the in-order queue: every transfer and kernel is
+    // enqueued without blocking, then a single finish() covers the batch.
+    // Returns how many leading jobs completed. If an enqueue fails partway,
+    // the queue is still drained so no transfer outlives the call, and the
+    // remaining jobs are left untouched for the caller to run elsewhere.
+    // Throws only if the queue itself fails, when no job's state is known.
+    size_t run(const std::vector<XorJob *> &jobs) {
+        size_t enqueued = 0;
+        try {
+            size_t max_bytes = 0;
+            for (auto *job : jobs)
+                max_bytes = std::max(max_bytes, job->length / VECTOR_WIDTH * VECTOR_WIDTH);
+            reserve(max_bytes);
+
+            for (auto *job : jobs) {
+                size_t bytes = job->length / VECTOR_WIDTH * VECTOR_WIDTH;
+                if (bytes != 0) {
+                    queue_.enqueueWriteBuffer(acc_, CL_FALSE, 0, bytes, job->sources[0]);
+                    for (size_t k = 1; k < job->sources.size(); ++k) {
+                        queue_.enqueueWriteBuffer(src_, CL_FALSE, 0, bytes, job->sources[k]);
+                        queue_.enqueueNDRangeKernel(kernel_, cl::NullRange,
+                                                    cl::NDRange(bytes / VECTOR_WIDTH));
+                    }
+                    queue_.enqueueReadBuffer(acc_, CL_FALSE, 0, bytes, job->dest);
+                }
+                ++enqueued;
+            }
+        } catch (...) {
+            // Drained below; jobs from `enqueued` on are left to the caller.
+        }
+        queue_.finish();
+
+        for (size_t i = 0; i < enqueued; ++i)
+            xor_range(*jobs[i], jobs[i]->length / VECTOR_WIDTH * VECTOR_WIDTH, jobs[i]->length);
+        return enqueued;
+    }
+
+private:
+    void reserve(size_t bytes) {
+        if (bytes <= capacity_)
+            return;
+        acc_ = cl::Buffer(context_, CL_MEM_READ_WRITE, bytes);
+        src_ = cl::Buffer(context_, CL_MEM_READ_ONLY, bytes);
+        kernel_.setArg(0, acc_);
+        kernel_.setArg(1, src_);
+        capacity_ = bytes;
+    }
+
+    cl::Device device_;
+    cl::Context context_;
+    cl::CommandQueue queue_;
+    cl::Kernel kernel_;
+    cl::Buffer acc_, src_;
+    size_t capacity_ = 0;
+};
+
+struct ParityEngine::Task {
+    XorJob job;
+    Completion done;
+    std::atomic<size_t> chunks_left{0};
+};
+
+ParityEngine::ParityEngine(EngineOptions options) : options_(options) {
+    options_.cpu_threads = std::max(1u, options_.cpu_threads);
+    options_.cpu_chunk_bytes = std::max<size_t>(options_.cpu_chunk_bytes, 4096);
+    options_.max_batch = std::max<size_t>(options_.max_batch, 1);
+
+    if (options_.use_opencl) {
+        try {
+            gpu_ = std::make_unique<OpenClBackend>();
+        } catch (const cl::Error &) {
+        } catch (const std::runtime_error &) {
+        }
+    }
+
+    for (unsigned i = 0; i < options_.cpu_threads; ++i)
+        cpu_workers_.emplace_back(&ParityEngine::cpu_loop, this);
+    if (gpu_)
+        gpu_thread_ = std::thread(&ParityEngine::gpu_loop, this);
+}
+
+ParityEngine::~ParityEngine() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [&] { return in_flight_ == 0; });
+        stopping_ = true;
+    }
+    cpu_cv_.notify_all();
+    gpu_cv_.notify_all();
+    for (auto &worker : cpu_workers_)
+        worker.join();
+    if (gpu_thread_.joinable())
+        gpu_thread_.join();
+}
+
+std::future<void> ParityEngine::submit(XorJob job) {
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+    submit(std::move(job), [promise](std::exception_ptr error) {
+        if (error)
+            promise->set_exception(error);
+        else
+            promise->set_value();
+    });
+    return future;
+}
+
+void ParityEngine::submit(XorJob job, Completion done) {
+    if (job.sources.empty() || !job.dest)
+        throw std::invalid_argument("XorJob needs at least one source and a destination");
+    if (std::find(job.sources.begin(), job.sources.end(), nullptr) != job.sources.end())
+        throw std::invalid_argument("XorJob source is null");
+    if (!done)
+        throw std::invalid_argument("Completion is empty");
+
+    auto task = std::make_shared<Task>();
+    task->job = std::move(job);
+    task->done = std::move(done);
+
+    const XorJob &j = task->job;
+    bool on_gpu = gpu_ && (j.backend == Backend::OpenCL ||
+                           (j.backend == Backend::Auto && j.length >= options_.gpu_min_bytes));
+
+    size_t chunks = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.submitted++;
+        stats_.peak_in_flight = std::max(stats_.peak_in_flight, ++in_flight_);
+
+        if (on_gpu) {
+            stats_.gpu_jobs++;
+            gpu_queue_.push_back(std::move(task));
+        } else {
+            stats_.cpu_jobs++;
+            chunks = queue_cpu_locked(task);
+        }
+    }
+
+    if (on_gpu)
+        gpu_cv_.notify_one();
+    else
+        wake_cpu(chunks);
+}
+
+size_t ParityEngine::queue_cpu_locked(const std::shared_ptr<Task> &task) {
+    const XorJob &j = task->job;
+    size_t chunk = options_.cpu_chunk_bytes;
+    size_t chunks = std::max<size_t>(1, (j.length + chunk - 1) / chunk);
+    task->chunks_left = chunks;
+    for (size_t c = 0; c < chunks; ++c)
+        cpu_queue_.push_back({task, c * chunk, std::min(j.length, (c + 1) * chunk)});
+    return chunks;
+}
+
+// Wake only as many workers as there are new chunks to take.
+void ParityEngine::wake_cpu(size_t chunks) {
+    if (chunks >= cpu_workers_.size()) {
+        cpu_cv_.notify_all();
+        return;
+    }
+    for (size_t i = 0; i < chunks; ++i)
+        cpu_cv_.notify_one();
+}
+
+EngineStats ParityEngine::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ParityEngine::cpu_loop() {
+    for (;;) {
+        CpuWork work;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cpu_cv_.wait(lock, [&] { return stopping_ || !cpu_queue_.empty(); });
+            if (cpu_queue_.empty())
+                return;
+            work = std::move(cpu_queue_.front());
+            cpu_queue_.pop_front();
+        }
+
+        xor_range(work.task->job, work.begin, work.end);
+        if (work.task->chunks_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            finish(work.task, nullptr);
+    }
+}
+
+void ParityEngine::gpu_loop() {
+    std::vector<std::shared_ptr<Task>> batch;
+    std::vector<XorJob *> jobs;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            gpu_cv_.wait(lock, [&] { return stopping_ || !gpu_queue_.empty(); });
+            if (gpu_queue_.empty())
+                return;
+            size_t n = std::min(options_.max_batch, gpu_queue_.size());
+            batch.assign(std::make_move_iterator(gpu_queue_.begin()),
+                         std::make_move_iterator(gpu_queue_.begin() + n));
+            gpu_queue_.erase(gpu_queue_.begin(), gpu_queue_.begin() + n);
+            stats_.gpu_batches++;
+        }
+
+        jobs.clear();
+        for (auto &task : batch)
+            jobs.push_back(&task->job);
+
+        size_t done = 0;
+        std::exception_ptr error;
+        try {
+            done = gpu_->run(jobs);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (error) {
+            for (auto &task : batch)
+                finish(task, error);
+            batch.clear();
+            continue;
+        }
+
+        for (size_t i = 0; i < done; ++i)
+            finish(batch[i], nullptr);
+        // Jobs the device could not take are rerun on the CPU workers.
+        size_t chunks = 0;
+        if (done < batch.size()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.gpu_fallbacks += batch.size() - done;
+            for (size_t i = done; i < batch.size(); ++i)
+                chunks += queue_cpu_locked(batch[i]);
+        }
+        wake_cpu(chunks);
+        batch.clear();
+    }
+}
+
+void ParityEngine::finish(const std::shared_ptr<Task> &task, std::exception_ptr error) {
+    task->done(error);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error)
+        stats_.failed++;
+    else
+        stats_.completed++;
+    if (--in_flight_ == 0)
+        idle_cv_.notify_all();
+}
+
+} // namespace gpuraid
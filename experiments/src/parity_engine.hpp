@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace gpuraid {
+
+enum class Backend { Auto, Cpu, OpenCL };
+
+// dest = sources[0] ^ sources[1] ^ ... over `length` bytes. All buffers are
+// owned by the caller and must stay valid until the job completes; dest may
+// alias one of the sources.
+struct XorJob {
+    std::vector<const uint8_t *> sources;
+    uint8_t *dest = nullptr;
+    size_t length = 0;
+    Backend backend = Backend::Auto;  // OpenCL falls back to Cpu without a device
+};
+
+// Called exactly once per job on an engine thread with null on success.
+// Must not throw.
+using Completion = std::function<void(std::exception_ptr)>;
+
+struct EngineOptions {
+    unsigned cpu_threads = std::thread::hardware_concurrency();
+    bool use_opencl = true;
+    size_t gpu_min_bytes = 1 << 20;     // Auto jobs smaller than this stay on the CPU
+    size_t cpu_chunk_bytes = 4 << 20;   // larger CPU jobs are split across workers
+    size_t max_batch = 64;              // jobs handed to a back end at once
+};
+
+struct EngineStats {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t cpu_jobs = 0;
+    uint64_t gpu_jobs = 0;
+    uint64_t gpu_batches = 0;
+    uint64_t gpu_fallbacks = 0;   // OpenCL jobs rerun on the CPU after an enqueue failure
+    uint64_t peak_in_flight = 0;
+};
+
+class OpenClBackend;
+
+// Non-blocking parity engine. One submitting thread can keep many jobs in
+// flight: submit() only routes the job to a queue. Large CPU jobs are split
+// into chunks across the worker pool. The OpenCL thread drains up to
+// max_batch jobs at a time, enqueues all their transfers and kernels without
+// blocking, and waits once for the whole batch.
+class ParityEngine {
+public:
+    explicit ParityEngine(EngineOptions options = {});
+    // Waits for every submitted job to complete.
+    ~ParityEngine();
+
+    ParityEngine(const ParityEngine &) = delete;
+    ParityEngine &operator=(const ParityEngine &) = delete;
+
+    // Throws std::invalid_argument for malformed jobs or an empty completion;
+    // back-end errors are delivered through the future or the completion
+    // instead. Jobs the OpenCL device fails to accept are rerun on the CPU.
+    std::future<void> submit(XorJob job);
+    void submit(XorJob job, Completion done);
+
+#if defined(__cpp_impl_coroutine)
+    class Awaitable {
+    public:
+        Awaitable(ParityEngine &engine, XorJob job) : engine_(engine), job_(std::move(job)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            engine_.submit(std::move(job_), [this, h](std::exception_ptr e) {
+                error_ = e;
+                h.resume();
+            });
+        }
+        void await_resume() const {
+            if (error_)
+                std::rethrow_exception(error_);
+        }
+
+    private:
+        ParityEngine &engine_;
+        XorJob job_;
+        std::exception_ptr error_;
+    };
+
+    // co_await engine.async_xor(job); resumes on an engine thread.
+    Awaitable async_xor(XorJob job) { return Awaitable(*this, std::move(job)); }
+#endif
+
+    bool has_opencl() const { return gpu_ != nullptr; }
+    EngineStats stats() const;
+
+private:
+    struct Task;
+    struct CpuWork {
+        std::shared_ptr<Task> task;
+        size_t begin, end;
+    };
+
+    void cpu_loop();
+    void gpu_loop();
+    size_t queue_cpu_locked(const std::shared_ptr<Task> &task);
+    void wake_cpu(size_t chunks);
+    void finish(const std::shared_ptr<Task> &task, std::exception_ptr error);
+
+    EngineOptions options_;
+    std::unique_ptr<OpenClBackend> gpu_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cpu_cv_, gpu_cv_, idle_cv_;
+    std::deque<CpuWork> cpu_queue_;
+    std::deque<std::shared_ptr<Task>> gpu_queue_;
+    bool stopping_ = false;
+    uint64_t in_flight_ = 0;
+    EngineStats stats_;
+
+    std::thread gpu_thread_;
+    std::vector<std::thread> cpu_workers_;
+};
+
+} // namespace gpuraid